@@ -0,0 +1,4 @@
+#
+# BLE notification packetizer. Pure C without IDF dependencies so it may be built and tested on host.
+#
+COMPONENT_ADD_INCLUDEDIRS := include
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Splits the byte stream into chunks sent as BLE notifications. Every chunk starts with a header
+ * followed by up to MTU - 3 - header size data bytes. The header starts with the sequence tag -
+ * the lower case letter 'a' + seq where seq is the chunk sequence number modulo PKT_SEQ_MOD.
+ * The retransmitted chunks are tagged by upper case letters. Two header formats are supported:
+ *   PKT_HDR_TAG - the tag only
+ *   PKT_HDR_EXT - the tag, flags (PKT_FLAG_xxx), 16 bit little endian stream offset of the first data byte
+ * The extended header lets the receiver tell the message boundaries and the amount of data lost.
+ *
+ * The data is pushed by the sender and then the chunks are pulled till none is ready. The chunk
+ * is ready once there is enough data to fill it or the end of the message was pushed. The data
+ * not filling the whole chunk is kept in the carry buffer till the next push. The end pushed with
+ * no data pending closes the message by the empty chunk with PKT_FLAG_LAST (PKT_HDR_EXT only).
+ * The MTU may be changed at any time, it takes effect starting from the next chunk pulled.
+ * Not thread safe.
+ */
+
+#define PKT_MTU_MIN   23
+#define PKT_MTU_MAX   517
+#define PKT_CHUNK_MAX (PKT_MTU_MAX - 3)
+
+#define PKT_SEQ_MOD   16
+#define PKT_SEQ_MASK  (PKT_SEQ_MOD - 1)
+
+#define PKT_FLAG_FIRST 1 // the chunk starts new message
+#define PKT_FLAG_LAST  2 // the chunk completes the message
+
+typedef enum {
+    PKT_HDR_TAG,
+    PKT_HDR_EXT,
+} pkt_hdr_t;
+
+typedef struct {
+    pkt_hdr_t      hdr;
+    uint16_t       chunk_max; // the max chunk size including header
+    uint8_t        seq;
+    bool           first;     // the next chunk starts new message
+    uint16_t       offset;    // the stream offset of the next data byte
+    // The data pushed but not pulled yet
+    const uint8_t* in;
+    size_t         in_len;
+    bool           in_end;
+    uint16_t       carry_len;
+    uint8_t        carry[PKT_CHUNK_MAX];
+} packetizer_t;
+
+// Received chunk information
+typedef struct {
+    uint8_t        seq;
+    bool           resent;
+    uint8_t        flags;  // PKT_HDR_EXT only
+    uint16_t       offset; // PKT_HDR_EXT only
+    const uint8_t* data;
+    size_t         len;
+} pkt_info_t;
+
+static inline size_t pkt_hdr_size(pkt_hdr_t hdr)
+{
+    return hdr == PKT_HDR_EXT ? 4 : 1;
+}
+
+static inline void pkt_set_tag(uint8_t* chunk, uint8_t seq, bool resent)
+{
+    chunk[0] = (resent ? 'A' : 'a') + (seq & PKT_SEQ_MASK);
+}
+
+void pkt_init(packetizer_t* p, pkt_hdr_t hdr, uint16_t mtu);
+
+// Drop pending data and restart sequence numbering
+void pkt_reset(packetizer_t* p);
+
+void pkt_set_mtu(packetizer_t* p, uint16_t mtu);
+
+// The max chunk size for the current MTU
+static inline size_t pkt_chunk_max(const packetizer_t* p)
+{
+    return p->chunk_max;
+}
+
+// Push data to be sent. The end flag marks the end of the message. The data is referenced
+// till the chunks are pulled. Returns false if the previously pushed data were not pulled yet.
+bool pkt_push(packetizer_t* p, const uint8_t* data, size_t len, bool end);
+
+// Put the next chunk to the buffer of at least pkt_chunk_max() bytes. Returns the chunk size
+// or 0 if no chunk is ready.
+size_t pkt_pull(packetizer_t* p, uint8_t* chunk);
+
+// Returns true if there are no data pushed but not pulled
+static inline bool pkt_empty(const packetizer_t* p)
+{
+    return !p->in_len && !p->carry_len;
+}
+
+// Parse received chunk. Returns false if it is malformed.
+bool pkt_parse(pkt_hdr_t hdr, const uint8_t* chunk, size_t len, pkt_info_t* info);
@@ -0,0 +1,132 @@
+#include "packetizer.h"
+
+#include <string.h>
+
+void pkt_init(packetizer_t* p, pkt_hdr_t hdr, uint16_t mtu)
+{
+    p->hdr = hdr;
+    pkt_set_mtu(p, mtu);
+    pkt_reset(p);
+}
+
+void pkt_reset(packetizer_t* p)
+{
+    p->seq = 0;
+    p->first = true;
+    p->offset = 0;
+    p->in = NULL;
+    p->in_len = 0;
+    p->in_end = false;
+    p->carry_len = 0;
+}
+
+void pkt_set_mtu(packetizer_t* p, uint16_t mtu)
+{
+    if (mtu < PKT_MTU_MIN)
+        mtu = PKT_MTU_MIN;
+    if (mtu > PKT_MTU_MAX)
+        mtu = PKT_MTU_MAX;
+    p->chunk_max = mtu - 3;
+}
+
+bool pkt_push(packetizer_t* p, const uint8_t* data, size_t len, bool end)
+{
+    if (p->in_len)
+        return false;
+    p->in = data;
+    p->in_len = len;
+    p->in_end = end;
+    return true;
+}
+
+// Put the header of the chunk with data starting at the current offset and advance the sequence
+static void pkt_put_hdr(packetizer_t* p, uint8_t* chunk, bool last)
+{
+    pkt_set_tag(chunk, p->seq, false);
+    if (p->hdr == PKT_HDR_EXT) {
+        chunk[1] = (p->first ? PKT_FLAG_FIRST : 0) | (last ? PKT_FLAG_LAST : 0);
+        chunk[2] = (uint8_t)p->offset;
+        chunk[3] = (uint8_t)(p->offset >> 8);
+    }
+    p->seq = (p->seq + 1) & PKT_SEQ_MASK;
+    p->first = last;
+}
+
+size_t pkt_pull(packetizer_t* p, uint8_t* chunk)
+{
+    size_t const hdr_sz = pkt_hdr_size(p->hdr);
+    size_t const max_data = p->chunk_max - hdr_sz;
+    size_t const avail = p->carry_len + p->in_len;
+    if (!avail) {
+        // The end of message with all its data pulled already. The next chunk starts new message
+        // and the extended header receiver is told the message is complete by the empty last chunk.
+        bool const close = p->in_end && !p->first;
+        p->in_end = false;
+        if (!close)
+            return 0;
+        if (p->hdr != PKT_HDR_EXT) {
+            p->first = true;
+            return 0;
+        }
+        pkt_put_hdr(p, chunk, true);
+        return hdr_sz;
+    }
+    if (avail < max_data && !p->in_end) {
+        // Keep the tail for the next push
+        memcpy(p->carry + p->carry_len, p->in, avail - p->carry_len);
+        p->carry_len = avail;
+        p->in_len = 0;
+        return 0;
+    }
+    size_t const len = avail < max_data ? avail : max_data;
+    uint8_t* out = chunk + hdr_sz;
+    size_t from_carry = 0;
+    if (p->carry_len) {
+        from_carry = p->carry_len < len ? p->carry_len : len;
+        memcpy(out, p->carry, from_carry);
+        p->carry_len -= from_carry;
+        // The carry may exceed the chunk after MTU decrease
+        if (p->carry_len)
+            memmove(p->carry, p->carry + from_carry, p->carry_len);
+        out += from_carry;
+    }
+    size_t const from_in = len - from_carry;
+    if (from_in) {
+        memcpy(out, p->in, from_in);
+        p->in += from_in;
+        p->in_len -= from_in;
+    }
+
+    bool const last = p->in_end && len == avail;
+    pkt_put_hdr(p, chunk, last);
+    p->offset += len;
+    if (last)
+        p->in_end = false;
+    return hdr_sz + len;
+}
+
+bool pkt_parse(pkt_hdr_t hdr, const uint8_t* chunk, size_t len, pkt_info_t* info)
+{
+    size_t const hdr_sz = pkt_hdr_size(hdr);
+    if (len < hdr_sz)
+        return false;
+    uint8_t const tag = chunk[0];
+    if (tag >= 'a' && tag < 'a' + PKT_SEQ_MOD) {
+        info->seq = tag - 'a';
+        info->resent = false;
+    } else if (tag >= 'A' && tag < 'A' + PKT_SEQ_MOD) {
+        info->seq = tag - 'A';
+        info->resent = true;
+    } else {
+        return false;
+    }
+    info->flags = 0;
+    info->offset = 0;
+    if (hdr == PKT_HDR_EXT) {
+        info->flags = chunk[1];
+        info->offset = chunk[2] | (chunk[3] << 8);
+    }
+    info->data = chunk + hdr_sz;
+    info->len = len - hdr_sz;
+    return true;
+}
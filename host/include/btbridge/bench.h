@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "btbridge/device.h"
+
+namespace btbridge {
+
+/*
+ * Client of the bridge self benchmark mode (see main/bench.h). The bench commands are sent
+ * in-band over SPP channel so the session must own the channel data while it is active.
+ */
+
+// The line switching the connection to bench mode
+constexpr char bench_cmd[] = "+++BENCH";
+
+// The test pattern byte at the given offset
+inline uint8_t bench_pattern(uint64_t i)
+{
+    return (uint8_t)(i ^ (i >> 8) ^ (i >> 16));
+}
+
+void bench_fill(uint8_t* data, uint64_t off, size_t size);
+// Returns the number of bytes not matching the pattern
+unsigned bench_verify(const uint8_t* data, uint64_t off, size_t size);
+
+// BENCH test=<name> bytes=<count> ms=<time> kbps=<rate> errors=<count>
+struct bench_report {
+    std::string test;
+    uint64_t    bytes = 0;
+    unsigned    ms = 0;
+    unsigned    kbps = 0;
+    unsigned    errors = 0;
+    unsigned    host_errors = 0; // pattern errors detected by host in gen test
+
+    static bool parse(const std::string& line, bench_report& r);
+    std::string str() const;
+};
+
+class bench_client {
+public:
+    // The report measured by device, except echo and loop tests measured by host.
+    // Called with empty test name if the session was reset before completion.
+    using done_fn = std::function<void(const bench_report&)>;
+
+    bench_client(device& dev, size_t chan = 0);
+
+    // Request bench mode, not needed if the bench strap is active
+    bool enter();
+    // Start test, returns false if another one is running or the channel is not connected.
+    // The echo and loop tests run on the device till disconnect so they should be the last ones.
+    bool run(const std::string& test, uint64_t bytes, done_fn done);
+    bool busy() const { return m_state != idle; }
+
+    // Should be called by device handler for the channel
+    void on_data(const buffer& b);
+    void on_drain();
+    // Abort the test on disconnect
+    void reset();
+
+    // The size of pattern chunks sent to the device
+    static const size_t chunk_size = 4096;
+
+private:
+    enum state_t { idle, wait_report, recv_pattern, recv_echo };
+
+    void feed(const uint8_t* data, size_t size);
+    void pump();
+    void complete(const bench_report& r);
+
+    device& m_dev;
+    size_t  m_chan;
+    state_t m_state = idle;
+    done_fn m_done;
+    bench_report m_report;
+    std::string  m_line;
+
+    uint64_t m_bytes = 0;      // the test size
+    uint64_t m_to_send = 0;    // pattern bytes to send
+    uint64_t m_sent = 0;
+    uint64_t m_recvd = 0;
+    unsigned m_errors = 0;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+}
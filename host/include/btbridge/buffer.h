@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace btbridge {
+
+class buffer_pool;
+
+/*
+ * Data block owned by a single party at a time. The received data is delivered in such blocks
+ * and the same block may be queued for sending to another stream without copying.
+ * The valid data lies between begin and end offsets so the sender may consume it partially.
+ */
+class buffer {
+public:
+    uint8_t*       data()       { return m_mem.get() + m_begin; }
+    const uint8_t* data() const { return m_mem.get() + m_begin; }
+    size_t size() const         { return m_end - m_begin; }
+    bool   empty() const        { return m_end == m_begin; }
+    size_t capacity() const     { return m_cap; }
+
+    // Free space after the data
+    uint8_t* tail()             { return m_mem.get() + m_end; }
+    size_t   tailroom() const   { return m_cap - m_end; }
+
+    // Account for n bytes written to tail
+    void commit(size_t n)       { m_end += n; }
+    // Drop n bytes from the beginning
+    void consume(size_t n)      { m_begin += n; }
+    void clear()                { m_begin = m_end = 0; }
+
+    // Copy data to tail, returns the number of bytes copied
+    size_t append(const void* data, size_t size);
+
+private:
+    friend class buffer_pool;
+    explicit buffer(size_t cap) : m_mem(new uint8_t[cap]), m_cap(cap) {}
+
+    std::unique_ptr<uint8_t[]> m_mem;
+    size_t m_cap;
+    size_t m_begin = 0;
+    size_t m_end   = 0;
+};
+
+struct buffer_release {
+    buffer_pool* pool;
+    void operator()(buffer* b) const;
+};
+
+using buffer_ptr = std::unique_ptr<buffer, buffer_release>;
+
+/*
+ * Recycles fixed size buffers so the steady state data flow does not allocate memory.
+ * Not thread safe, it is meant to be used by the event loop thread. The pool must outlive
+ * the buffers taken from it.
+ */
+class buffer_pool {
+public:
+    explicit buffer_pool(size_t block_size = 4096, size_t max_free = 1024);
+    ~buffer_pool();
+
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    buffer_ptr get();
+
+    size_t block_size() const { return m_block_size; }
+    // The number of buffers ever allocated
+    size_t allocated() const  { return m_allocated; }
+
+private:
+    friend struct buffer_release;
+    void put(buffer* b);
+
+    size_t m_block_size;
+    size_t m_max_free;
+    size_t m_allocated = 0;
+    std::vector<buffer*> m_free;
+};
+
+}
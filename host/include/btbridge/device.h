@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "btbridge/event_loop.h"
+#include "btbridge/stream.h"
+
+namespace btbridge {
+
+/*
+ * The bridge channel address. Every SPP channel of the bridge is a separate RFCOMM server channel
+ * (1 and 2 if the second channel is enabled). The bridge data is plain byte stream, there is
+ * no framing, so the channels are the only way to multiplex independent data flows.
+ */
+struct endpoint {
+    enum kind_t { rfcomm, tty, custom };
+
+    kind_t      kind = rfcomm;
+    std::string addr;      // bluetooth address or tty path
+    unsigned    param = 1; // RFCOMM channel or tty baud rate
+    // Custom connector for testing, returns connected descriptor or -1
+    std::function<int()> open_fn;
+
+    // Parse XX:XX:XX:XX:XX:XX[@channel] or /dev/path[:baud]
+    static bool parse(const std::string& str, endpoint& ep);
+    std::string str() const;
+};
+
+/*
+ * The bridge with one or more channels. The channels are connected on start and reconnected
+ * after failure or disconnection. The handler is called with the channel index.
+ */
+class device {
+public:
+    struct handler {
+        std::function<void(device&, size_t chan)>             on_connect;
+        std::function<void(device&, size_t chan, buffer_ptr)> on_data;
+        std::function<void(device&, size_t chan)>             on_drain;
+        std::function<void(device&, size_t chan, int err)>    on_disconnect;
+    };
+
+    device(event_loop& loop, std::string name, std::vector<endpoint> endpoints, handler h);
+    ~device();
+
+    device(const device&) = delete;
+    device& operator=(const device&) = delete;
+
+    void start();
+    void stop();
+    void set_reconnect_delay(std::chrono::milliseconds delay) { m_reconnect_delay = delay; }
+
+    // Queue data for sending, returns false if the channel is not connected
+    bool send(size_t chan, buffer_ptr b);
+    bool send(size_t chan, const void* data, size_t size);
+
+    bool connected(size_t chan) const;
+    // The channel stream or nullptr if not connected
+    stream* channel(size_t chan);
+
+    size_t channels() const { return m_chans.size(); }
+    const std::string& name() const { return m_name; }
+    const endpoint& channel_endpoint(size_t chan) const { return m_chans[chan].ep; }
+    event_loop& loop() { return m_loop; }
+
+private:
+    struct chan_state {
+        endpoint                ep;
+        std::shared_ptr<stream> s;
+        bool                    open = false;
+        event_loop::timer_id    retry = 0;
+    };
+
+    void connect(size_t chan);
+    void schedule_connect(size_t chan);
+    void on_opened(size_t chan);
+    void on_closed(size_t chan, int err);
+    void drop_stream(chan_state& c);
+
+    event_loop& m_loop;
+    std::string m_name;
+    handler     m_handler;
+    bool        m_started = false;
+    std::chrono::milliseconds m_reconnect_delay{1000};
+    std::vector<chan_state> m_chans;
+};
+
+}
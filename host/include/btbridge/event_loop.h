@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "btbridge/buffer.h"
+
+namespace btbridge {
+
+/*
+ * Single threaded epoll event loop serving any number of file descriptors and timers.
+ * The handlers may add or remove descriptors and timers, including their own, at any time.
+ * Only post() and stop() may be called from other threads.
+ */
+class event_loop {
+public:
+    using fd_handler = std::function<void(uint32_t events)>;
+    using timer_id   = uint64_t;
+
+    explicit event_loop(size_t buffer_size = 4096);
+    ~event_loop();
+
+    event_loop(const event_loop&) = delete;
+    event_loop& operator=(const event_loop&) = delete;
+
+    // Watch descriptor for EPOLLxx events
+    void add(int fd, uint32_t events, fd_handler handler);
+    void modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    timer_id call_later(std::chrono::milliseconds delay, std::function<void()> fn);
+    void cancel(timer_id id);
+
+    // Run function on the loop thread
+    void post(std::function<void()> fn);
+
+    // Run till stop() is called
+    void run();
+    // Wait for events at most timeout_ms (-1 means forever) and handle them
+    void run_once(int timeout_ms);
+    void stop();
+
+    buffer_pool& pool() { return m_pool; }
+
+private:
+    struct watch {
+        int        fd;
+        uint64_t   gen;
+        fd_handler handler;
+    };
+
+    void run_timers();
+    int  next_timeout(int timeout_ms) const;
+    void run_posted();
+
+    int m_epoll_fd;
+    int m_wake_fd;
+    bool m_stop = false;
+    uint64_t m_gen = 0;
+    std::unordered_map<int, std::shared_ptr<watch>> m_watches;      // by descriptor
+    std::unordered_map<uint64_t, std::shared_ptr<watch>> m_watch_gen; // by generation passed to epoll
+
+    using clock = std::chrono::steady_clock;
+    timer_id m_timer_seq = 0;
+    std::multimap<clock::time_point, timer_id> m_deadlines;
+    std::unordered_map<timer_id, std::pair<clock::time_point, std::function<void()>>> m_timers;
+
+    std::mutex m_posted_lock;
+    std::vector<std::function<void()>> m_posted;
+
+    buffer_pool m_pool;
+};
+
+}
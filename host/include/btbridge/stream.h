@@ -0,0 +1,81 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <memory>
+
+#include "btbridge/buffer.h"
+#include "btbridge/event_loop.h"
+
+namespace btbridge {
+
+/*
+ * Non-blocking byte stream over socket or tty descriptor served by the event loop.
+ * Received data is delivered in pool buffers handed over to the receiver. The buffers
+ * passed to send() are queued as is and written by writev() once the descriptor is writable.
+ * The callbacks may close the stream. To destroy it from the callback use event_loop::post().
+ */
+class stream {
+public:
+    struct callbacks {
+        std::function<void()>           on_open;   // connection established
+        std::function<void(buffer_ptr)> on_data;
+        std::function<void()>           on_drain;  // send queue dropped below low water mark
+        std::function<void(int err)>    on_close;  // closed by peer (err = 0) or failed
+    };
+
+    // Take ownership of the descriptor. If connecting is true the descriptor has non-blocking
+    // connect in progress and the stream is open once it becomes writable.
+    stream(event_loop& loop, int fd, bool connecting, callbacks cb);
+    ~stream();
+
+    stream(const stream&) = delete;
+    stream& operator=(const stream&) = delete;
+
+    // Queue buffer for sending. Returns false if the stream is closed.
+    bool send(buffer_ptr b);
+    // Copy data to pool buffers and queue them
+    bool send(const void* data, size_t size);
+
+    // Bytes queued for sending
+    size_t queued() const { return m_queued; }
+    // The on_drain is called once the queue drops below low water mark after exceeding high water mark
+    void set_water_marks(size_t low, size_t high) { m_low_water = low; m_high_water = high; }
+    bool congested() const { return m_queued >= m_high_water; }
+
+    // Stop or resume reading, may be used to push back on the sender
+    void pause_reading(bool pause);
+
+    void close();
+    bool is_open() const { return m_fd >= 0 && !m_connecting; }
+    int  fd() const { return m_fd; }
+
+    // The max number of reads per readiness notification so a busy stream does not starve others
+    static const int max_reads = 16;
+
+private:
+    void on_events(uint32_t events);
+    void on_connected();
+    bool do_read(bool force);
+    bool do_write();
+    void update_events();
+    void fail(int err);
+
+    event_loop& m_loop;
+    int         m_fd;
+    bool        m_connecting;
+    bool        m_paused = false;
+    uint32_t    m_events = 0;
+    callbacks   m_cb;
+
+    std::deque<buffer_ptr> m_queue;
+    size_t m_queued = 0;
+    size_t m_low_water  = 16 * 1024;
+    size_t m_high_water = 64 * 1024;
+    bool   m_was_congested = false;
+
+    // Reset on destruction so the event handler can tell the stream was destroyed by callback
+    std::shared_ptr<bool> m_alive;
+};
+
+}
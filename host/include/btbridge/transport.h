@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace btbridge {
+
+// Parse bluetooth address in the form XX:XX:XX:XX:XX:XX to the little endian byte order used by the kernel
+bool parse_bdaddr(const std::string& str, uint8_t addr[6]);
+
+// Create RFCOMM socket and start non-blocking connect to the given channel.
+// Returns descriptor or -1 with errno set. The connection is complete once the socket is writable.
+int rfcomm_connect(const std::string& addr, uint8_t channel);
+
+// Open tty in raw non-blocking mode with the given baud rate (0 keeps the current one).
+// Returns descriptor or -1 with errno set.
+int tty_open(const std::string& path, unsigned baud);
+
+}
@@ -0,0 +1,194 @@
+#include "btbridge/bench.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace btbridge {
+
+// Longer lines are not reports so they are dropped
+constexpr size_t line_max = 256;
+
+void bench_fill(uint8_t* data, uint64_t off, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+        data[i] = bench_pattern(off + i);
+}
+
+unsigned bench_verify(const uint8_t* data, uint64_t off, size_t size)
+{
+    unsigned errors = 0;
+    for (size_t i = 0; i < size; ++i)
+        if (data[i] != bench_pattern(off + i))
+            ++errors;
+    return errors;
+}
+
+bool bench_report::parse(const std::string& line, bench_report& r)
+{
+    char test[32];
+    unsigned long long bytes;
+    unsigned ms, kbps, errors;
+    if (sscanf(line.c_str(), "BENCH test=%31s bytes=%llu ms=%u kbps=%u errors=%u", test, &bytes, &ms, &kbps, &errors) != 5)
+        return false;
+    r.test = test;
+    r.bytes = bytes;
+    r.ms = ms;
+    r.kbps = kbps;
+    r.errors = errors;
+    r.host_errors = 0;
+    return true;
+}
+
+std::string bench_report::str() const
+{
+    char line[160];
+    int len = snprintf(line, sizeof(line), "BENCH test=%s bytes=%llu ms=%u kbps=%u errors=%u",
+        test.c_str(), (unsigned long long)bytes, ms, kbps, errors);
+    if (test == "gen")
+        snprintf(line + len, sizeof(line) - len, " host_errors=%u", host_errors);
+    return line;
+}
+
+bench_client::bench_client(device& dev, size_t chan)
+    : m_dev(dev)
+    , m_chan(chan)
+{
+}
+
+bool bench_client::enter()
+{
+    std::string const line = std::string(bench_cmd) + '\n';
+    return m_dev.send(m_chan, line.data(), line.size());
+}
+
+bool bench_client::run(const std::string& test, uint64_t bytes, done_fn done)
+{
+    if (m_state != idle || !m_dev.connected(m_chan))
+        return false;
+    std::string cmd = test;
+    if (test != "echo" && test != "loop")
+        cmd += " " + std::to_string(bytes);
+    cmd += "\n";
+    m_dev.send(m_chan, cmd.data(), cmd.size());
+
+    m_done = std::move(done);
+    m_line.clear();
+    m_report = bench_report();
+    m_report.test = test;
+    m_bytes = bytes;
+    m_to_send = 0;
+    m_sent = m_recvd = 0;
+    m_errors = 0;
+    m_start = std::chrono::steady_clock::now();
+    if (test == "gen") {
+        m_state = recv_pattern;
+    } else if (test == "echo" || test == "loop") {
+        m_state = recv_echo;
+        m_to_send = bytes;
+    } else {
+        m_state = wait_report;
+        if (test == "check")
+            m_to_send = bytes;
+    }
+    pump();
+    return true;
+}
+
+// Send pattern till the channel is congested, continued on drain
+void bench_client::pump()
+{
+    stream* const s = m_dev.channel(m_chan);
+    if (!s)
+        return;
+    while (m_sent < m_to_send && !s->congested()) {
+        buffer_ptr b = m_dev.loop().pool().get();
+        size_t n = b->tailroom() < chunk_size ? b->tailroom() : chunk_size;
+        if (n > m_to_send - m_sent)
+            n = m_to_send - m_sent;
+        bench_fill(b->tail(), m_sent, n);
+        b->commit(n);
+        m_sent += n;
+        s->send(std::move(b));
+    }
+}
+
+void bench_client::on_drain()
+{
+    pump();
+}
+
+void bench_client::on_data(const buffer& b)
+{
+    feed(b.data(), b.size());
+}
+
+void bench_client::feed(const uint8_t* data, size_t size)
+{
+    while (size) {
+        if (m_state == recv_pattern || m_state == recv_echo) {
+            size_t n = size;
+            if (n > m_bytes - m_recvd)
+                n = m_bytes - m_recvd;
+            m_errors += bench_verify(data, m_recvd, n);
+            m_recvd += n;
+            data += n;
+            size -= n;
+            if (m_recvd < m_bytes)
+                continue;
+            if (m_state == recv_pattern) {
+                m_state = wait_report;
+                continue;
+            }
+            // The echo test is measured on the host side
+            auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - m_start).count();
+            bench_report r;
+            r.test = m_report.test;
+            r.bytes = m_bytes;
+            r.ms = (unsigned)ms;
+            r.kbps = ms ? (unsigned)(m_bytes * 8 / ms) : 0;
+            r.errors = m_errors;
+            complete(r);
+            // The device keeps echoing till disconnect, nothing else is expected
+            return;
+        }
+        uint8_t const* const eol = (const uint8_t*)memchr(data, '\n', size);
+        size_t const n = eol ? eol - data + 1 : size;
+        m_line.append((const char*)data, n);
+        data += n;
+        size -= n;
+        if (!eol) {
+            if (m_line.size() > line_max)
+                m_line.clear();
+            continue;
+        }
+        std::string line;
+        line.swap(m_line);
+        bench_report r;
+        if (m_state == wait_report && bench_report::parse(line, r)) {
+            r.host_errors = m_errors;
+            complete(r);
+        }
+    }
+}
+
+void bench_client::complete(const bench_report& r)
+{
+    m_state = idle;
+    done_fn done;
+    done.swap(m_done);
+    if (done)
+        done(r);
+}
+
+void bench_client::reset()
+{
+    m_line.clear();
+    if (m_state == idle)
+        return;
+    m_state = idle;
+    m_to_send = 0;
+    complete(bench_report());
+}
+
+}
@@ -0,0 +1,58 @@
+#include "btbridge/buffer.h"
+
+#include <cstring>
+
+namespace btbridge {
+
+size_t buffer::append(const void* data, size_t size)
+{
+    if (size > tailroom())
+        size = tailroom();
+    memcpy(tail(), data, size);
+    commit(size);
+    return size;
+}
+
+void buffer_release::operator()(buffer* b) const
+{
+    if (pool)
+        pool->put(b);
+    else
+        delete b;
+}
+
+buffer_pool::buffer_pool(size_t block_size, size_t max_free)
+    : m_block_size(block_size)
+    , m_max_free(max_free)
+{
+}
+
+buffer_pool::~buffer_pool()
+{
+    for (buffer* b : m_free)
+        delete b;
+}
+
+buffer_ptr buffer_pool::get()
+{
+    buffer* b;
+    if (m_free.empty()) {
+        b = new buffer(m_block_size);
+        ++m_allocated;
+    } else {
+        b = m_free.back();
+        m_free.pop_back();
+        b->clear();
+    }
+    return buffer_ptr(b, buffer_release{this});
+}
+
+void buffer_pool::put(buffer* b)
+{
+    if (m_free.size() < m_max_free)
+        m_free.push_back(b);
+    else
+        delete b;
+}
+
+}
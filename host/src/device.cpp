@@ -0,0 +1,178 @@
+#include "btbridge/device.h"
+#include "btbridge/transport.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+namespace btbridge {
+
+bool endpoint::parse(const std::string& str, endpoint& ep)
+{
+    size_t const sep = str.find_last_of("@:");
+    if (!str.empty() && str[0] == '/') {
+        ep.kind = tty;
+        ep.param = 0;
+        ep.addr = str;
+        if (sep != std::string::npos && str[sep] == ':') {
+            ep.addr = str.substr(0, sep);
+            ep.param = strtoul(str.c_str() + sep + 1, nullptr, 10);
+        }
+        return true;
+    }
+    uint8_t bdaddr[6];
+    ep.kind = rfcomm;
+    ep.param = 1;
+    ep.addr = str;
+    if (sep != std::string::npos && str[sep] == '@') {
+        ep.addr = str.substr(0, sep);
+        ep.param = strtoul(str.c_str() + sep + 1, nullptr, 10);
+    }
+    return parse_bdaddr(ep.addr, bdaddr) && ep.param >= 1 && ep.param <= 30;
+}
+
+std::string endpoint::str() const
+{
+    switch (kind) {
+    case rfcomm:
+        return addr + "@" + std::to_string(param);
+    case tty:
+        return param ? addr + ":" + std::to_string(param) : addr;
+    default:
+        return addr.empty() ? "custom" : addr;
+    }
+}
+
+device::device(event_loop& loop, std::string name, std::vector<endpoint> endpoints, handler h)
+    : m_loop(loop)
+    , m_name(std::move(name))
+    , m_handler(std::move(h))
+{
+    m_chans.resize(endpoints.size());
+    for (size_t i = 0; i < endpoints.size(); ++i)
+        m_chans[i].ep = std::move(endpoints[i]);
+}
+
+device::~device()
+{
+    stop();
+}
+
+void device::start()
+{
+    m_started = true;
+    for (size_t i = 0; i < m_chans.size(); ++i)
+        if (!m_chans[i].s && !m_chans[i].retry)
+            connect(i);
+}
+
+void device::stop()
+{
+    m_started = false;
+    for (auto& c : m_chans) {
+        if (c.retry) {
+            m_loop.cancel(c.retry);
+            c.retry = 0;
+        }
+        drop_stream(c);
+    }
+}
+
+// The stream may be destroyed from its own callback so release it on the next loop iteration
+void device::drop_stream(chan_state& c)
+{
+    c.open = false;
+    if (!c.s)
+        return;
+    c.s->close();
+    std::shared_ptr<stream> s;
+    s.swap(c.s);
+    m_loop.post([s] {});
+}
+
+void device::schedule_connect(size_t chan)
+{
+    if (!m_started)
+        return;
+    m_chans[chan].retry = m_loop.call_later(m_reconnect_delay, [this, chan] {
+        m_chans[chan].retry = 0;
+        connect(chan);
+    });
+}
+
+void device::connect(size_t chan)
+{
+    chan_state& c = m_chans[chan];
+    int fd;
+    bool connecting = false;
+    switch (c.ep.kind) {
+    case endpoint::rfcomm:
+        fd = rfcomm_connect(c.ep.addr, c.ep.param);
+        connecting = true;
+        break;
+    case endpoint::tty:
+        fd = tty_open(c.ep.addr, c.ep.param);
+        break;
+    default:
+        fd = c.ep.open_fn ? c.ep.open_fn() : -1;
+        break;
+    }
+    if (fd < 0) {
+        if (m_handler.on_disconnect)
+            m_handler.on_disconnect(*this, chan, errno);
+        schedule_connect(chan);
+        return;
+    }
+    stream::callbacks cb;
+    cb.on_open = [this, chan] { on_opened(chan); };
+    cb.on_data = [this, chan](buffer_ptr b) {
+        if (m_handler.on_data)
+            m_handler.on_data(*this, chan, std::move(b));
+    };
+    cb.on_drain = [this, chan] {
+        if (m_handler.on_drain)
+            m_handler.on_drain(*this, chan);
+    };
+    cb.on_close = [this, chan](int err) { on_closed(chan, err); };
+    c.s = std::make_shared<stream>(m_loop, fd, connecting, std::move(cb));
+    if (!connecting)
+        on_opened(chan);
+}
+
+void device::on_opened(size_t chan)
+{
+    m_chans[chan].open = true;
+    if (m_handler.on_connect)
+        m_handler.on_connect(*this, chan);
+}
+
+void device::on_closed(size_t chan, int err)
+{
+    drop_stream(m_chans[chan]);
+    if (m_handler.on_disconnect)
+        m_handler.on_disconnect(*this, chan, err);
+    schedule_connect(chan);
+}
+
+bool device::send(size_t chan, buffer_ptr b)
+{
+    stream* const s = channel(chan);
+    return s && s->send(std::move(b));
+}
+
+bool device::send(size_t chan, const void* data, size_t size)
+{
+    stream* const s = channel(chan);
+    return s && s->send(data, size);
+}
+
+bool device::connected(size_t chan) const
+{
+    return chan < m_chans.size() && m_chans[chan].open;
+}
+
+stream* device::channel(size_t chan)
+{
+    return connected(chan) ? m_chans[chan].s.get() : nullptr;
+}
+
+}
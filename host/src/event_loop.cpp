@@ -0,0 +1,180 @@
+#include "btbridge/event_loop.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace btbridge {
+
+#define MAX_EVENTS 64
+
+static std::runtime_error sys_error(const char* what)
+{
+    return std::runtime_error(std::string(what) + ": " + strerror(errno));
+}
+
+event_loop::event_loop(size_t buffer_size)
+    : m_pool(buffer_size)
+{
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd < 0)
+        throw sys_error("epoll_create1");
+    m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wake_fd < 0) {
+        ::close(m_epoll_fd);
+        throw sys_error("eventfd");
+    }
+    add(m_wake_fd, EPOLLIN, [this](uint32_t) {
+        uint64_t cnt;
+        while (::read(m_wake_fd, &cnt, sizeof(cnt)) > 0)
+            ;
+        run_posted();
+    });
+}
+
+event_loop::~event_loop()
+{
+    ::close(m_wake_fd);
+    ::close(m_epoll_fd);
+}
+
+void event_loop::add(int fd, uint32_t events, fd_handler handler)
+{
+    auto w = std::make_shared<watch>(watch{fd, ++m_gen, std::move(handler)});
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = w->gen;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        throw sys_error("epoll_ctl add");
+    m_watch_gen[w->gen] = w;
+    m_watches[fd] = std::move(w);
+}
+
+void event_loop::modify(int fd, uint32_t events)
+{
+    auto const it = m_watches.find(fd);
+    if (it == m_watches.end())
+        return;
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.u64 = it->second->gen;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)
+        throw sys_error("epoll_ctl mod");
+}
+
+void event_loop::remove(int fd)
+{
+    auto const it = m_watches.find(fd);
+    if (it == m_watches.end())
+        return;
+    m_watch_gen.erase(it->second->gen);
+    m_watches.erase(it);
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+event_loop::timer_id event_loop::call_later(std::chrono::milliseconds delay, std::function<void()> fn)
+{
+    timer_id const id = ++m_timer_seq;
+    clock::time_point const deadline = clock::now() + delay;
+    m_deadlines.emplace(deadline, id);
+    m_timers.emplace(id, std::make_pair(deadline, std::move(fn)));
+    return id;
+}
+
+void event_loop::cancel(timer_id id)
+{
+    auto const it = m_timers.find(id);
+    if (it == m_timers.end())
+        return;
+    auto range = m_deadlines.equal_range(it->second.first);
+    for (auto d = range.first; d != range.second; ++d) {
+        if (d->second == id) {
+            m_deadlines.erase(d);
+            break;
+        }
+    }
+    m_timers.erase(it);
+}
+
+void event_loop::post(std::function<void()> fn)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_posted_lock);
+        m_posted.push_back(std::move(fn));
+    }
+    uint64_t const one = 1;
+    ssize_t const res = ::write(m_wake_fd, &one, sizeof(one));
+    (void)res;
+}
+
+void event_loop::run_posted()
+{
+    std::vector<std::function<void()>> posted;
+    {
+        std::lock_guard<std::mutex> lock(m_posted_lock);
+        posted.swap(m_posted);
+    }
+    for (auto& fn : posted)
+        fn();
+}
+
+void event_loop::stop()
+{
+    post([this] { m_stop = true; });
+}
+
+void event_loop::run()
+{
+    m_stop = false;
+    while (!m_stop)
+        run_once(-1);
+}
+
+int event_loop::next_timeout(int timeout_ms) const
+{
+    if (m_deadlines.empty())
+        return timeout_ms;
+    auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(m_deadlines.begin()->first - clock::now());
+    // Round up so the timer is due once we wake up
+    int const ms = left.count() < 0 ? 0 : (int)left.count() + 1;
+    return timeout_ms < 0 || ms < timeout_ms ? ms : timeout_ms;
+}
+
+void event_loop::run_timers()
+{
+    clock::time_point const now = clock::now();
+    while (!m_deadlines.empty() && m_deadlines.begin()->first <= now) {
+        timer_id const id = m_deadlines.begin()->second;
+        m_deadlines.erase(m_deadlines.begin());
+        auto const it = m_timers.find(id);
+        if (it == m_timers.end())
+            continue;
+        std::function<void()> fn = std::move(it->second.second);
+        m_timers.erase(it);
+        fn();
+    }
+}
+
+void event_loop::run_once(int timeout_ms)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int const n = epoll_wait(m_epoll_fd, events, MAX_EVENTS, next_timeout(timeout_ms));
+    if (n < 0 && errno != EINTR)
+        throw sys_error("epoll_wait");
+    for (int i = 0; i < n; ++i) {
+        // The watch may be removed or replaced by the handlers called before
+        auto const it = m_watch_gen.find(events[i].data.u64);
+        if (it == m_watch_gen.end())
+            continue;
+        // Keep the handler alive while it runs even if it removes itself
+        std::shared_ptr<watch> const w = it->second;
+        w->handler(events[i].events);
+    }
+    run_timers();
+}
+
+}
@@ -0,0 +1,198 @@
+#include "btbridge/stream.h"
+
+#include <cerrno>
+#include <climits>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace btbridge {
+
+#define MAX_IOV 64
+
+stream::stream(event_loop& loop, int fd, bool connecting, callbacks cb)
+    : m_loop(loop)
+    , m_fd(fd)
+    , m_connecting(connecting)
+    , m_cb(std::move(cb))
+    , m_alive(std::make_shared<bool>(true))
+{
+    m_events = connecting ? EPOLLOUT : EPOLLIN;
+    m_loop.add(m_fd, m_events, [this](uint32_t events) { on_events(events); });
+}
+
+stream::~stream()
+{
+    *m_alive = false;
+    close();
+}
+
+void stream::close()
+{
+    if (m_fd < 0)
+        return;
+    m_loop.remove(m_fd);
+    ::close(m_fd);
+    m_fd = -1;
+    m_queue.clear();
+    m_queued = 0;
+}
+
+bool stream::send(buffer_ptr b)
+{
+    if (m_fd < 0)
+        return false;
+    if (b->empty())
+        return true;
+    m_queued += b->size();
+    m_queue.push_back(std::move(b));
+    if (m_queued >= m_high_water)
+        m_was_congested = true;
+    update_events();
+    return true;
+}
+
+bool stream::send(const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size) {
+        buffer_ptr b = m_loop.pool().get();
+        size_t const n = b->append(p, size);
+        p += n;
+        size -= n;
+        if (!send(std::move(b)))
+            return false;
+    }
+    return true;
+}
+
+void stream::pause_reading(bool pause)
+{
+    m_paused = pause;
+    update_events();
+}
+
+void stream::update_events()
+{
+    if (m_fd < 0)
+        return;
+    uint32_t events;
+    if (m_connecting) {
+        events = EPOLLOUT;
+    } else {
+        events = m_paused ? 0 : (uint32_t)EPOLLIN;
+        if (!m_queue.empty())
+            events |= EPOLLOUT;
+    }
+    if (events != m_events) {
+        m_events = events;
+        m_loop.modify(m_fd, events);
+    }
+}
+
+void stream::fail(int err)
+{
+    close();
+    if (m_cb.on_close)
+        m_cb.on_close(err);
+}
+
+void stream::on_connected()
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        err = errno;
+    if (err) {
+        fail(err);
+        return;
+    }
+    m_connecting = false;
+    update_events();
+    if (m_cb.on_open)
+        m_cb.on_open();
+}
+
+void stream::on_events(uint32_t events)
+{
+    std::shared_ptr<bool> const alive = m_alive;
+    if (m_connecting) {
+        on_connected();
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        // Hang up is reported even while reading is paused, read till the end of data then
+        if (!do_read(events & (EPOLLHUP | EPOLLERR)) || !*alive || m_fd < 0)
+            return;
+    }
+    if (events & EPOLLOUT)
+        do_write();
+}
+
+// Returns false if the stream was closed
+bool stream::do_read(bool force)
+{
+    std::shared_ptr<bool> const alive = m_alive;
+    for (int i = 0; i < max_reads && (force || !m_paused); ++i) {
+        buffer_ptr b = m_loop.pool().get();
+        ssize_t const n = ::read(m_fd, b->tail(), b->tailroom());
+        if (n > 0) {
+            b->commit(n);
+            if (m_cb.on_data) {
+                m_cb.on_data(std::move(b));
+                if (!*alive || m_fd < 0)
+                    return false;
+            }
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0 && errno == EINTR)
+            continue;
+        // The pty master reads EIO once the slave side is closed
+        fail(n == 0 || errno == EIO ? 0 : errno);
+        return false;
+    }
+    return true;
+}
+
+bool stream::do_write()
+{
+    while (!m_queue.empty()) {
+        struct iovec iov[MAX_IOV];
+        int cnt = 0;
+        for (auto it = m_queue.begin(); it != m_queue.end() && cnt < MAX_IOV; ++it, ++cnt) {
+            iov[cnt].iov_base = (*it)->data();
+            iov[cnt].iov_len  = (*it)->size();
+        }
+        ssize_t n = ::writev(m_fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            fail(errno);
+            return false;
+        }
+        m_queued -= n;
+        while (n) {
+            buffer& b = *m_queue.front();
+            if ((size_t)n < b.size()) {
+                b.consume(n);
+                break;
+            }
+            n -= b.size();
+            m_queue.pop_front();
+        }
+    }
+    update_events();
+    if (m_was_congested && m_queued < m_low_water) {
+        m_was_congested = false;
+        if (m_cb.on_drain)
+            m_cb.on_drain();
+    }
+    return true;
+}
+
+}
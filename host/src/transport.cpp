@@ -0,0 +1,107 @@
+#include "btbridge/transport.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+// The bluetooth socket definitions are taken from the kernel ABI so the library
+// does not depend on libbluetooth headers
+#ifndef AF_BLUETOOTH
+#define AF_BLUETOOTH 31
+#endif
+#define BTPROTO_RFCOMM 3
+
+struct sockaddr_rc_local {
+    sa_family_t rc_family;
+    uint8_t     rc_bdaddr[6];
+    uint8_t     rc_channel;
+};
+
+namespace btbridge {
+
+bool parse_bdaddr(const std::string& str, uint8_t addr[6])
+{
+    unsigned b[6];
+    char tail;
+    if (sscanf(str.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x%c", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &tail) != 6)
+        return false;
+    for (int i = 0; i < 6; ++i)
+        addr[i] = b[5 - i];
+    return true;
+}
+
+int rfcomm_connect(const std::string& addr, uint8_t channel)
+{
+    struct sockaddr_rc_local sa = {};
+    sa.rc_family = AF_BLUETOOTH;
+    sa.rc_channel = channel;
+    if (!parse_bdaddr(addr, sa.rc_bdaddr)) {
+        errno = EINVAL;
+        return -1;
+    }
+    int const fd = socket(AF_BLUETOOTH, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, BTPROTO_RFCOMM);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS) {
+        int const err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static speed_t tty_speed(unsigned baud)
+{
+    switch (baud) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 921600:  return B921600;
+    case 1000000: return B1000000;
+    case 1500000: return B1500000;
+    default:      return 0;
+    }
+}
+
+int tty_open(const std::string& path, unsigned baud)
+{
+    speed_t const speed = tty_speed(baud);
+    if (baud && !speed) {
+        errno = EINVAL;
+        return -1;
+    }
+    int const fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    struct termios tio;
+    if (tcgetattr(fd, &tio) < 0) {
+        int const err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    if (speed) {
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
+    if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+        int const err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+}
@@ -0,0 +1,398 @@
+/*
+ * Host library tests against socketpair and pty stand-ins of the bridge.
+ * Every stand-in is served by its own thread with blocking I/O the way the bridge firmware
+ * serves SPP connection, while the library serves all of them from the single event loop.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "btbridge/bench.h"
+#include "btbridge/device.h"
+#include "btbridge/transport.h"
+
+using namespace btbridge;
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        ++failures; \
+    } \
+} while (0)
+
+static bool write_all(int fd, const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size) {
+        ssize_t const n = ::write(fd, p, size);
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Send back everything received till the peer closes connection
+static void fake_echo(int fd)
+{
+    uint8_t buff[1024];
+    for (;;) {
+        ssize_t const n = ::read(fd, buff, sizeof(buff));
+        if (n <= 0 || !write_all(fd, buff, n))
+            break;
+    }
+    ::close(fd);
+}
+
+static void bench_reply(int fd, const char* test, uint64_t bytes, unsigned errors)
+{
+    char line[128];
+    int const len = snprintf(line, sizeof(line), "BENCH test=%s bytes=%llu ms=10 kbps=%llu errors=%u\n",
+        test, (unsigned long long)bytes, (unsigned long long)bytes * 8 / 10, errors);
+    write_all(fd, line, len);
+}
+
+// The bench mode command interpreter as implemented by main/bench.c
+static void fake_bench(int fd)
+{
+    std::string line;
+    uint8_t buff[1024];
+    std::string pending;
+    for (;;) {
+        size_t eol;
+        while ((eol = pending.find('\n')) == std::string::npos) {
+            ssize_t const n = ::read(fd, buff, sizeof(buff));
+            if (n <= 0)
+                goto done;
+            pending.append((const char*)buff, n);
+        }
+        line = pending.substr(0, eol);
+        pending.erase(0, eol + 1);
+        char cmd[16] = "";
+        unsigned long long bytes = 0;
+        sscanf(line.c_str(), "%15s %llu", cmd, &bytes);
+        if (!strcmp(cmd, "echo")) {
+            write_all(fd, pending.data(), pending.size());
+            fake_echo(fd);
+            return;
+        } else if (!strcmp(cmd, "gen")) {
+            for (uint64_t off = 0; off < bytes; off += sizeof(buff)) {
+                size_t const n = bytes - off < sizeof(buff) ? bytes - off : sizeof(buff);
+                bench_fill(buff, off, n);
+                if (!write_all(fd, buff, n))
+                    goto done;
+            }
+            bench_reply(fd, cmd, bytes, 0);
+        } else if (!strcmp(cmd, "check")) {
+            uint64_t recvd = 0;
+            unsigned errors = 0;
+            while (recvd < bytes) {
+                if (pending.empty()) {
+                    ssize_t const n = ::read(fd, buff, sizeof(buff));
+                    if (n <= 0)
+                        goto done;
+                    pending.assign((const char*)buff, n);
+                }
+                size_t const n = bytes - recvd < pending.size() ? bytes - recvd : pending.size();
+                errors += bench_verify((const uint8_t*)pending.data(), recvd, n);
+                recvd += n;
+                pending.erase(0, n);
+            }
+            bench_reply(fd, cmd, bytes, errors);
+        } else if (!strcmp(cmd, "uart")) {
+            bench_reply(fd, cmd, bytes, 0);
+        }
+    }
+done:
+    ::close(fd);
+}
+
+// The stand-in device connected by socketpair
+struct fake_device {
+    std::thread thread;
+    std::atomic<int> connects{0};
+};
+
+static endpoint fake_endpoint(fake_device& fake, void (*serve)(int fd), bool fail_first = false)
+{
+    endpoint ep;
+    ep.kind = endpoint::custom;
+    ep.open_fn = [&fake, serve, fail_first]() -> int {
+        if (fail_first && !fake.connects++) {
+            errno = ECONNREFUSED;
+            return -1;
+        }
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) < 0)
+            return -1;
+        int const flags = fcntl(sv[1], F_GETFL);
+        fcntl(sv[1], F_SETFL, flags & ~O_NONBLOCK);
+        if (fake.thread.joinable())
+            fake.thread.join();
+        fake.thread = std::thread(serve, sv[1]);
+        return sv[0];
+    };
+    return ep;
+}
+
+static void test_parse()
+{
+    endpoint ep;
+    CHECK(endpoint::parse("01:23:45:67:89:AB@2", ep));
+    CHECK(ep.kind == endpoint::rfcomm && ep.addr == "01:23:45:67:89:AB" && ep.param == 2);
+    CHECK(endpoint::parse("01:23:45:67:89:ab", ep) && ep.param == 1);
+    CHECK(!endpoint::parse("01:23:45:67:89", ep));
+    CHECK(!endpoint::parse("01:23:45:67:89:AB@31", ep));
+    CHECK(endpoint::parse("/dev/ttyUSB0:115200", ep));
+    CHECK(ep.kind == endpoint::tty && ep.addr == "/dev/ttyUSB0" && ep.param == 115200);
+
+    uint8_t addr[6];
+    CHECK(parse_bdaddr("01:23:45:67:89:AB", addr) && addr[0] == 0xab && addr[5] == 0x01);
+
+    bench_report r;
+    CHECK(bench_report::parse("BENCH test=gen bytes=1000 ms=20 kbps=400 errors=3", r));
+    CHECK(r.test == "gen" && r.bytes == 1000 && r.ms == 20 && r.kbps == 400 && r.errors == 3);
+    CHECK(!bench_report::parse("E (123) bench: failed", r));
+}
+
+// Many devices echoing pattern at full rate concurrently. The received buffers are forwarded
+// back to the device without copying so the pool should not grow with the data volume.
+static void test_many_devices(int count, uint64_t bytes)
+{
+    event_loop loop;
+    std::vector<std::unique_ptr<fake_device>> fakes;
+    std::vector<std::unique_ptr<device>> devs;
+    std::vector<uint64_t> sent(count), recvd(count);
+    unsigned errors = 0;
+    int completed = 0;
+
+    // Stage 1: send pattern, the devices echo it, verify and count
+    for (int i = 0; i < count; ++i) {
+        fakes.emplace_back(new fake_device);
+        device::handler h;
+        auto pump = [&, i](device& dev, size_t chan) {
+            stream* const s = dev.channel(chan);
+            while (s && sent[i] < bytes && !s->congested()) {
+                buffer_ptr b = loop.pool().get();
+                size_t n = b->tailroom();
+                if (n > bytes - sent[i])
+                    n = bytes - sent[i];
+                bench_fill(b->tail(), sent[i], n);
+                b->commit(n);
+                sent[i] += n;
+                s->send(std::move(b));
+            }
+        };
+        h.on_connect = pump;
+        h.on_drain = pump;
+        h.on_data = [&, i](device& dev, size_t, buffer_ptr b) {
+            errors += bench_verify(b->data(), recvd[i], b->size());
+            recvd[i] += b->size();
+            if (recvd[i] == bytes) {
+                dev.stop();
+                if (++completed == count)
+                    loop.stop();
+            }
+        };
+        devs.emplace_back(new device(loop, "fake" + std::to_string(i), {fake_endpoint(*fakes.back(), fake_echo)}, h));
+    }
+    auto const start = std::chrono::steady_clock::now();
+    for (auto& d : devs)
+        d->start();
+    loop.call_later(std::chrono::seconds(30), [&] { loop.stop(); });
+    loop.run();
+    auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    CHECK(completed == count);
+    CHECK(errors == 0);
+    printf("%d devices echoed %llu bytes each in %lld ms, %llu kbps total, %zu buffers\n",
+        count, (unsigned long long)bytes, (long long)ms,
+        ms ? (unsigned long long)(bytes * count * 8 / ms) : 0ULL, loop.pool().allocated());
+    size_t const allocated = loop.pool().allocated();
+    devs.clear();
+
+    // Stage 2: forward received buffers back as is, the pool should be reused
+    completed = 0;
+    std::vector<uint64_t> fwd(count);
+    for (int i = 0; i < count; ++i) {
+        device::handler h;
+        h.on_connect = [&](device& dev, size_t chan) {
+            // Seed one buffer that bounces back and forth till the limit
+            buffer_ptr b = loop.pool().get();
+            bench_fill(b->tail(), 0, b->tailroom());
+            b->commit(b->tailroom());
+            dev.send(chan, std::move(b));
+        };
+        h.on_data = [&, i](device& dev, size_t chan, buffer_ptr b) {
+            fwd[i] += b->size();
+            if (fwd[i] >= bytes) {
+                dev.stop();
+                if (++completed == count)
+                    loop.stop();
+                return;
+            }
+            dev.send(chan, std::move(b));
+        };
+        devs.emplace_back(new device(loop, "fwd" + std::to_string(i), {fake_endpoint(*fakes[i], fake_echo)}, h));
+    }
+    for (auto& d : devs)
+        d->start();
+    loop.call_later(std::chrono::seconds(30), [&] { loop.stop(); });
+    loop.run();
+    CHECK(completed == count);
+    // The forwarding needs no more buffers than the echo stage had in flight
+    CHECK(loop.pool().allocated() <= allocated + (size_t)count * stream::max_reads);
+    devs.clear();
+    for (auto& f : fakes)
+        if (f->thread.joinable())
+            f->thread.join();
+}
+
+static void test_bench()
+{
+    event_loop loop;
+    fake_device fake;
+    std::unique_ptr<bench_client> bench;
+    std::vector<bench_report> reports;
+    std::vector<std::string> const tests = {"gen", "check", "uart", "echo"};
+    uint64_t const bytes = 300000;
+
+    device::handler h;
+    std::function<void()> next = [&] {
+        if (reports.size() == tests.size()) {
+            loop.stop();
+            return;
+        }
+        bench->run(tests[reports.size()], bytes, [&](const bench_report& r) {
+            reports.push_back(r);
+            next();
+        });
+    };
+    h.on_connect = [&](device&, size_t) {
+        bench->enter();
+        next();
+    };
+    h.on_data = [&](device&, size_t, buffer_ptr b) { bench->on_data(*b); };
+    h.on_drain = [&](device&, size_t) { bench->on_drain(); };
+    device dev(loop, "bench", {fake_endpoint(fake, fake_bench)}, h);
+    bench.reset(new bench_client(dev));
+    dev.start();
+    loop.call_later(std::chrono::seconds(30), [&] { loop.stop(); });
+    loop.run();
+    CHECK(reports.size() == tests.size());
+    for (size_t i = 0; i < reports.size(); ++i) {
+        printf("%s\n", reports[i].str().c_str());
+        CHECK(reports[i].test == tests[i]);
+        CHECK(reports[i].bytes == bytes);
+        CHECK(reports[i].errors == 0 && reports[i].host_errors == 0);
+    }
+    dev.stop();
+    if (fake.thread.joinable())
+        fake.thread.join();
+}
+
+// The device drops the first connection attempt and then the connection after the first data
+static void close_after_data(int fd)
+{
+    uint8_t buff[64];
+    ssize_t const n = ::read(fd, buff, sizeof(buff));
+    (void)n;
+    ::close(fd);
+}
+
+static void test_reconnect()
+{
+    event_loop loop;
+    fake_device fake;
+    int connects = 0, disconnects = 0;
+    device::handler h;
+    h.on_connect = [&](device& dev, size_t chan) {
+        ++connects;
+        if (connects < 3)
+            dev.send(chan, "hello", 5);
+        else
+            loop.stop();
+    };
+    h.on_disconnect = [&](device&, size_t, int) { ++disconnects; };
+    device dev(loop, "reconnect", {fake_endpoint(fake, close_after_data, true)}, h);
+    dev.set_reconnect_delay(std::chrono::milliseconds(10));
+    dev.start();
+    loop.call_later(std::chrono::seconds(10), [&] { loop.stop(); });
+    loop.run();
+    // One failed attempt and two connections closed by the device
+    CHECK(connects == 3);
+    CHECK(disconnects == 3);
+    CHECK(fake.connects == 4);
+    dev.stop();
+    if (fake.thread.joinable())
+        fake.thread.join();
+}
+
+// The tty endpoint over pseudo terminal, the master side plays the device
+static void test_pty()
+{
+    int const master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK(master >= 0);
+    if (master < 0)
+        return;
+    CHECK(grantpt(master) == 0 && unlockpt(master) == 0);
+    std::string const path = ptsname(master);
+
+    event_loop loop;
+    std::string received;
+    std::string const msg = "ping through pty";
+    device::handler h;
+    h.on_connect = [&](device& dev, size_t chan) { dev.send(chan, msg.data(), msg.size()); };
+    h.on_data = [&](device&, size_t, buffer_ptr b) {
+        received.append((const char*)b->data(), b->size());
+        if (received.size() >= msg.size())
+            loop.stop();
+    };
+    endpoint ep;
+    CHECK(endpoint::parse(path + ":115200", ep));
+    device dev(loop, "pty", {ep}, h);
+    dev.start();
+    CHECK(dev.connected(0));
+    std::thread echo([master] {
+        uint8_t buff[256];
+        ssize_t const n = ::read(master, buff, sizeof(buff));
+        if (n > 0)
+            write_all(master, buff, n);
+    });
+    loop.call_later(std::chrono::seconds(5), [&] { loop.stop(); });
+    loop.run();
+    echo.join();
+    CHECK(received == msg);
+    dev.stop();
+    ::close(master);
+}
+
+int main(int argc, char* argv[])
+{
+    int const devices = argc > 1 ? atoi(argv[1]) : 32;
+    uint64_t const bytes = argc > 2 ? strtoull(argv[2], nullptr, 10) : 4000000;
+
+    test_parse();
+    test_many_devices(devices, bytes);
+    test_bench();
+    test_reconnect();
+    test_pty();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
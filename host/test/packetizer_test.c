@@ -0,0 +1,270 @@
+/*
+ * Property based tests and microbenchmark of the BLE packetizer (components/packetizer).
+ * Random streams are split into messages pushed in random pieces while the MTU is changed
+ * at random points. Some messages are ended by the empty push. The chunks pulled are parsed and
+ * checked against the following properties:
+ *   - the data is delivered unchanged and in order, the pushed buffers are not modified
+ *   - the chunk fits the MTU at the time it was pulled and has no less than one data byte
+ *     except the empty chunk closing the message with the extended header
+ *   - the chunk is shorter than maximum only if it completes the message
+ *   - the tags go in sequence modulo PKT_SEQ_MOD
+ *   - the extended header flags and offsets match the message boundaries and stream position
+ * Usage: packetizer_test [iterations [seed]] - run the tests (the seed is taken from time by default)
+ *        packetizer_test bench                - run the benchmark
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#include "packetizer.h"
+
+#define STREAM_MAX (64 * 1024)
+
+static uint32_t rnd_state;
+
+static uint32_t rnd(void)
+{
+    // xorshift32
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static uint32_t rnd_range(uint32_t lo, uint32_t hi)
+{
+    return lo + rnd() % (hi - lo + 1);
+}
+
+static uint16_t rnd_mtu(void)
+{
+    // Prefer the typical values over the uniform distribution
+    static const uint16_t common[] = {PKT_MTU_MIN, 24, 27, 185, 247, 251, 512, PKT_MTU_MAX};
+    if (rnd() & 1)
+        return common[rnd() % (sizeof(common) / sizeof(common[0]))];
+    return rnd_range(PKT_MTU_MIN, PKT_MTU_MAX);
+}
+
+struct rx_state {
+    uint8_t  data[STREAM_MAX];
+    size_t   len;
+    unsigned chunks;
+    uint8_t  next_seq;
+    bool     msg_open;
+};
+
+#define FAIL(...) do { \
+    fprintf(stderr, "seed %u: ", seed); \
+    fprintf(stderr, __VA_ARGS__); \
+    fprintf(stderr, "\n"); \
+    return false; \
+} while (0)
+
+// Check chunk and append its data to the received stream
+static bool rx_chunk(uint32_t seed, struct rx_state* rx, pkt_hdr_t hdr, const uint8_t* chunk, size_t len,
+                     size_t chunk_max, bool msg_end_pushed, size_t pending)
+{
+    pkt_info_t info;
+    if (!pkt_parse(hdr, chunk, len, &info))
+        FAIL("malformed chunk %u", rx->chunks);
+    if (len > chunk_max)
+        FAIL("chunk %u size %zu exceeds %zu", rx->chunks, len, chunk_max);
+    bool const last = msg_end_pushed && !pending;
+    if (!info.len && !(hdr == PKT_HDR_EXT && last && rx->msg_open))
+        FAIL("chunk %u has no data", rx->chunks);
+    if (info.resent || info.seq != rx->next_seq)
+        FAIL("chunk %u tag %c, expected %c", rx->chunks, chunk[0], 'a' + rx->next_seq);
+    if (len < chunk_max && !last)
+        FAIL("chunk %u size %zu is short of %zu before the end of message", rx->chunks, len, chunk_max);
+    if (hdr == PKT_HDR_EXT) {
+        if (!!(info.flags & PKT_FLAG_FIRST) == rx->msg_open)
+            FAIL("chunk %u first flag mismatch", rx->chunks);
+        if (!!(info.flags & PKT_FLAG_LAST) != last)
+            FAIL("chunk %u last flag mismatch", rx->chunks);
+        if (info.offset != (uint16_t)rx->len)
+            FAIL("chunk %u offset %u, expected %u", rx->chunks, info.offset, (uint16_t)rx->len);
+        rx->msg_open = !last;
+    }
+    memcpy(rx->data + rx->len, info.data, info.len);
+    rx->len += info.len;
+    rx->next_seq = (rx->next_seq + 1) & PKT_SEQ_MASK;
+    ++rx->chunks;
+    return true;
+}
+
+// Pull all chunks ready changing the MTU at random points
+static bool pull_all(uint32_t seed, packetizer_t* p, struct rx_state* rx, pkt_hdr_t hdr, bool end, size_t pending)
+{
+    uint8_t chunk[PKT_CHUNK_MAX];
+    for (;;) {
+        if (!(rnd() % 8))
+            pkt_set_mtu(p, rnd_mtu());
+        size_t const chunk_max = pkt_chunk_max(p);
+        size_t const len = pkt_pull(p, chunk);
+        if (!len)
+            return true;
+        pending -= len - pkt_hdr_size(hdr);
+        if (!rx_chunk(seed, rx, hdr, chunk, len, chunk_max, end, pending))
+            return false;
+    }
+}
+
+static bool run_case(uint32_t seed)
+{
+    static uint8_t stream[STREAM_MAX], copy[STREAM_MAX];
+    static struct rx_state rx;
+    static packetizer_t p;
+
+    rnd_state = seed;
+    pkt_hdr_t const hdr = rnd() & 1 ? PKT_HDR_EXT : PKT_HDR_TAG;
+    size_t const total = rnd_range(0, STREAM_MAX);
+    for (size_t i = 0; i < total; ++i)
+        stream[i] = rnd();
+    memcpy(copy, stream, total);
+    memset(&rx, 0, sizeof(rx));
+    pkt_init(&p, hdr, rnd_mtu());
+
+    size_t off = 0, msg_left = 0;
+    while (off < total) {
+        if (!msg_left)
+            msg_left = rnd_range(1, rnd() & 1 ? 64 : 4096);
+        size_t piece = rnd_range(0, rnd() & 1 ? 32 : 2048);
+        if (piece > msg_left)
+            piece = msg_left;
+        if (piece > total - off)
+            piece = total - off;
+        msg_left -= piece;
+        bool end = !msg_left || off + piece == total;
+        if (!(rnd() % 16)) {
+            // End the message by the empty push, possibly right after it was ended already
+            if (!pkt_push(&p, stream + off, piece, false))
+                FAIL("push refused at %zu", off);
+            if (!pull_all(seed, &p, &rx, hdr, false, p.carry_len + piece))
+                return false;
+            off += piece;
+            piece = 0;
+            end = true;
+        }
+        if (!pkt_push(&p, stream + off, piece, end))
+            FAIL("push refused at %zu", off);
+        off += piece;
+        if (end)
+            msg_left = 0;
+        if (!pull_all(seed, &p, &rx, hdr, end, p.carry_len + piece))
+            return false;
+        if (end && !pkt_empty(&p))
+            FAIL("data left after the end of message at %zu", off);
+        if (end && rx.msg_open)
+            FAIL("message not closed at %zu", off);
+    }
+    if (rx.len != total || memcmp(rx.data, copy, total))
+        FAIL("received data mismatch, %zu of %zu bytes", rx.len, total);
+    if (memcmp(stream, copy, total))
+        FAIL("pushed data modified");
+    return true;
+}
+
+static bool test_parse(void)
+{
+    uint32_t const seed = 0;
+    pkt_info_t info;
+    uint8_t const resent[] = {'C', 1, 2};
+    uint8_t const ext[] = {'p', PKT_FLAG_FIRST | PKT_FLAG_LAST, 0x34, 0x12, 9};
+    if (pkt_parse(PKT_HDR_TAG, (const uint8_t*)"q", 1, &info))
+        FAIL("tag out of range accepted");
+    if (pkt_parse(PKT_HDR_EXT, (const uint8_t*)"abc", 3, &info))
+        FAIL("short header accepted");
+    if (!pkt_parse(PKT_HDR_TAG, resent, sizeof(resent), &info) || !info.resent || info.seq != 2 || info.len != 2)
+        FAIL("resent chunk parse failed");
+    if (!pkt_parse(PKT_HDR_EXT, ext, sizeof(ext), &info) || info.seq != 15 || info.offset != 0x1234 || info.len != 1
+            || info.flags != (PKT_FLAG_FIRST | PKT_FLAG_LAST))
+        FAIL("extended header parse failed");
+    return true;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Push UART sized pieces the way uart_task does and pull all chunks
+static void bench(pkt_hdr_t hdr, uint16_t mtu, size_t piece)
+{
+    static uint8_t data[1024 * 1024];
+    static packetizer_t p;
+    uint8_t chunk[PKT_CHUNK_MAX];
+    int const rounds = 64;
+    size_t bytes = 0, chunks = 0;
+    for (size_t i = 0; i < sizeof(data); ++i)
+        data[i] = i;
+    pkt_init(&p, hdr, mtu);
+    // Warm up caches
+    pkt_push(&p, data, sizeof(data), true);
+    while (pkt_pull(&p, chunk))
+        ;
+    double const start = now_sec();
+#ifdef HAVE_TSC
+    uint64_t const tsc_start = __rdtsc();
+#endif
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t off = 0; off < sizeof(data); off += piece) {
+            size_t const n = off + piece < sizeof(data) ? piece : sizeof(data) - off;
+            pkt_push(&p, data + off, n, off + n == sizeof(data));
+            size_t len;
+            while ((len = pkt_pull(&p, chunk)) != 0) {
+                bytes += len;
+                ++chunks;
+            }
+        }
+    }
+#ifdef HAVE_TSC
+    uint64_t const cycles = __rdtsc() - tsc_start;
+#endif
+    double const sec = now_sec() - start;
+    printf("%s mtu %3u piece %4zu: %8.1f MB/s %6.1f ns/chunk", hdr == PKT_HDR_EXT ? "ext" : "tag", mtu, piece,
+        bytes / sec / 1e6, sec * 1e9 / chunks);
+#ifdef HAVE_TSC
+    printf(" %6.3f bytes/cycle", (double)bytes / cycles);
+#endif
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        bench(PKT_HDR_TAG, 23, 120);
+        bench(PKT_HDR_TAG, 247, 120);
+        bench(PKT_HDR_TAG, 517, 120);
+        bench(PKT_HDR_TAG, 517, 4096);
+        bench(PKT_HDR_EXT, 247, 120);
+        bench(PKT_HDR_EXT, 517, 4096);
+        return 0;
+    }
+
+    unsigned const iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 2000;
+    uint32_t seed = argc > 2 ? strtoul(argv[2], NULL, 0) : (uint32_t)time(NULL);
+    unsigned failed = 0;
+
+    if (!test_parse())
+        ++failed;
+    for (unsigned i = 0; i < iterations; ++i, seed = seed * 1103515245 + 12345) {
+        if (!seed)
+            continue;
+        if (!run_case(seed) && ++failed >= 10)
+            break;
+    }
+    if (failed) {
+        fprintf(stderr, "%u cases failed, rerun with: packetizer_test 1 <seed>\n", failed);
+        return 1;
+    }
+    printf("%u random cases passed\n", iterations);
+    return 0;
+}
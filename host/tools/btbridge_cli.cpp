@@ -0,0 +1,169 @@
+/*
+ * Run self benchmark or monitor received data on any number of bridges at once.
+ *
+ * Usage: btbridge_cli [-m] [-s] [-b bytes] [-t test,...] [-T timeout] device...
+ *
+ * The device is given by comma separated list of its channel endpoints:
+ *   XX:XX:XX:XX:XX:XX[@channel] - RFCOMM channel (1 by default)
+ *   /dev/path[:baud]            - tty
+ * The benchmark runs on the first channel of every device. The tests are the same as in
+ * test/bt_bench.py (default is gen,check,uart,echo). The monitor mode (-m) prints received
+ * data rate of every channel once per second till interrupted.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <unistd.h>
+
+#include "btbridge/bench.h"
+#include "btbridge/device.h"
+
+using namespace btbridge;
+
+struct options {
+    bool     monitor = false;
+    bool     strapped = false;
+    uint64_t bytes = 1000000;
+    unsigned timeout = 60;
+    std::vector<std::string> tests = {"gen", "check", "uart", "echo"};
+};
+
+struct bridge {
+    std::unique_ptr<device>       dev;
+    std::unique_ptr<bench_client> bench;
+    std::vector<uint64_t>         rx_bytes;
+    size_t next_test = 0;
+    bool   done = false;
+};
+
+static options opts;
+static size_t  running;
+
+static void run_next(bridge& br)
+{
+    if (br.next_test >= opts.tests.size()) {
+        br.done = true;
+        br.dev->stop();
+        if (!--running)
+            br.dev->loop().stop();
+        return;
+    }
+    br.bench->run(opts.tests[br.next_test++], opts.bytes, [&br](const bench_report& r) {
+        if (r.test.empty())
+            return;
+        printf("%s: %s\n", br.dev->name().c_str(), r.str().c_str());
+        fflush(stdout);
+        run_next(br);
+    });
+}
+
+static std::vector<std::string> split(const std::string& str, char sep)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, sep))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: btbridge_cli [-m] [-s] [-b bytes] [-t test,...] [-T timeout] device...\n");
+    exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "msb:t:T:")) != -1) {
+        switch (opt) {
+        case 'm': opts.monitor = true; break;
+        case 's': opts.strapped = true; break;
+        case 'b': opts.bytes = strtoull(optarg, nullptr, 10); break;
+        case 't': opts.tests = split(optarg, ','); break;
+        case 'T': opts.timeout = strtoul(optarg, nullptr, 10); break;
+        default: usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+
+    event_loop loop;
+    std::vector<std::unique_ptr<bridge>> bridges;
+
+    for (int i = optind; i < argc; ++i) {
+        std::vector<endpoint> endpoints;
+        for (auto const& s : split(argv[i], ',')) {
+            endpoint ep;
+            if (!endpoint::parse(s, ep)) {
+                fprintf(stderr, "invalid endpoint: %s\n", s.c_str());
+                return 1;
+            }
+            endpoints.push_back(ep);
+        }
+        if (endpoints.empty())
+            usage();
+        bridges.emplace_back(new bridge);
+        bridge& br = *bridges.back();
+        br.rx_bytes.resize(endpoints.size());
+
+        device::handler h;
+        h.on_connect = [&br](device& dev, size_t chan) {
+            fprintf(stderr, "%s: channel %zu connected\n", dev.name().c_str(), chan);
+            if (opts.monitor || chan || br.done)
+                return;
+            if (!opts.strapped)
+                br.bench->enter();
+            run_next(br);
+        };
+        h.on_data = [&br](device&, size_t chan, buffer_ptr b) {
+            br.rx_bytes[chan] += b->size();
+            if (!chan && br.bench->busy())
+                br.bench->on_data(*b);
+        };
+        h.on_drain = [&br](device&, size_t chan) {
+            if (!chan)
+                br.bench->on_drain();
+        };
+        h.on_disconnect = [&br](device& dev, size_t chan, int err) {
+            fprintf(stderr, "%s: channel %zu disconnected: %s\n", dev.name().c_str(), chan, err ? strerror(err) : "closed");
+            if (!chan) {
+                // The interrupted test is restarted from the beginning of the list after reconnect
+                br.bench->reset();
+                br.next_test = 0;
+            }
+        };
+        br.dev.reset(new device(loop, argv[i], std::move(endpoints), std::move(h)));
+        br.bench.reset(new bench_client(*br.dev));
+        ++running;
+    }
+
+    for (auto& br : bridges)
+        br->dev->start();
+
+    if (opts.monitor) {
+        std::function<void()> tick = [&] {
+            for (auto& br : bridges) {
+                for (size_t chan = 0; chan < br->rx_bytes.size(); ++chan) {
+                    printf("%s#%zu: %llu B/s\n", br->dev->name().c_str(), chan, (unsigned long long)br->rx_bytes[chan]);
+                    br->rx_bytes[chan] = 0;
+                }
+            }
+            fflush(stdout);
+            loop.call_later(std::chrono::seconds(1), tick);
+        };
+        loop.call_later(std::chrono::seconds(1), tick);
+    } else {
+        loop.call_later(std::chrono::seconds(opts.timeout), [&] {
+            fprintf(stderr, "timeout, %zu devices not completed\n", running);
+            loop.stop();
+        });
+    }
+    loop.run();
+    return running ? 2 : 0;
+}
@@ -0,0 +1,342 @@
+#include "bench.h"
+
+#ifdef BENCH_EN
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "soc/uart_struct.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sys/unistd.h"
+#include "ble_server.h"
+
+#define BENCH_TAG "BENCH"
+
+#define BENCH_TOUT_US   5000000
+#define BENCH_UART_WND  1024 // max bytes in flight in UART loopback test
+#define BENCH_BLE_MSG   128  // max BLE test message length
+
+static bool bench_strap;
+
+struct bench_result {
+    const char* test;
+    uint32_t    bytes;
+    int64_t     time_us;
+    uint32_t    errors;
+};
+
+void bench_init(void)
+{
+    gpio_pad_select_gpio(CONFIG_BENCH_GPIO);
+    gpio_set_direction(CONFIG_BENCH_GPIO, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(CONFIG_BENCH_GPIO, GPIO_PULLUP_ONLY);
+    bench_strap = !gpio_get_level(CONFIG_BENCH_GPIO);
+    if (bench_strap)
+        ESP_LOGI(BENCH_TAG, "bench mode strapped");
+}
+
+bool bench_strapped(void)
+{
+    return bench_strap;
+}
+
+bool bench_requested(const uint8_t* data, int size)
+{
+#ifdef CONFIG_BENCH_CMD_EN
+    return size >= sizeof(BENCH_CMD) - 1 && !memcmp(data, BENCH_CMD, sizeof(BENCH_CMD) - 1);
+#else
+    return false;
+#endif
+}
+
+static volatile uart_dev_t* bench_uart_dev(uart_port_t uart)
+{
+    switch (uart) {
+    case UART_NUM_0:
+        return &UART0;
+    case UART_NUM_1:
+        return &UART1;
+    default:
+        return &UART2;
+    }
+}
+
+static void bench_uart_loopback(uart_port_t uart, bool en)
+{
+    bench_uart_dev(uart)->conf0.loopback = en;
+}
+
+static int bench_write(int fd, const void* data, int size)
+{
+    const uint8_t* ptr = data;
+    int remain = size;
+    while (remain > 0) {
+        int const res = write(fd, ptr, remain);
+        if (res < 0)
+            return -1;
+        if (!res) {
+            vTaskDelay(1);
+            continue;
+        }
+        remain -= res;
+        ptr += res;
+    }
+    return size;
+}
+
+static int bench_report(int fd, const struct bench_result* r)
+{
+    char line[128];
+    uint32_t const ms = r->time_us / 1000;
+    uint32_t const kbps = r->time_us ? (uint32_t)((uint64_t)r->bytes * 8000 / r->time_us) : 0;
+    int const len = snprintf(line, sizeof(line), "BENCH test=%s bytes=%u ms=%u kbps=%u errors=%u\n",
+                        r->test, r->bytes, ms, kbps, r->errors);
+    ESP_LOGI(BENCH_TAG, "%.*s", len - 1, line);
+    return bench_write(fd, line, len);
+}
+
+// Read command line. Returns its length or -1 on disconnect.
+static int bench_read_line(bench_state_t* b, int fd)
+{
+    for (;;) {
+        char* const eol = memchr(b->line, '\n', b->line_len);
+        if (eol) {
+            int const len = eol - b->line;
+            *eol = 0;
+            if (len && b->line[len - 1] == '\r')
+                b->line[len - 1] = 0;
+            return len;
+        }
+        if (b->line_len >= BENCH_LINE_MAX - 1) {
+            // Too long, discard
+            b->line_len = 0;
+        }
+        int const res = read(fd, b->line + b->line_len, BENCH_LINE_MAX - 1 - b->line_len);
+        if (res < 0)
+            return -1;
+        if (!res)
+            vTaskDelay(1);
+        b->line_len += res;
+    }
+}
+
+static void bench_line_consume(bench_state_t* b, int len)
+{
+    b->line_len -= len + 1;
+    memmove(b->line, b->line + len + 1, b->line_len);
+}
+
+// Echo BT data back bypassing UART
+static int bench_echo(bench_state_t* b, int fd)
+{
+    struct bench_result r = {.test = "echo"};
+    int64_t const start = esp_timer_get_time();
+    for (;;) {
+        int const size = read(fd, b->buff, BENCH_BUFF_SZ);
+        if (size < 0)
+            break;
+        if (!size) {
+            vTaskDelay(1);
+            continue;
+        }
+        if (bench_write(fd, b->buff, size) < 0)
+            break;
+        r.bytes += size;
+    }
+    r.time_us = esp_timer_get_time() - start;
+    ESP_LOGI(BENCH_TAG, "echo %u bytes in %u ms", r.bytes, (uint32_t)(r.time_us / 1000));
+    return -1;
+}
+
+// Bridge BT to UART with internal loopback
+static int bench_loop(bench_state_t* b, int fd, uart_port_t uart)
+{
+    uint32_t bytes = 0;
+    bench_uart_loopback(uart, true);
+    uart_flush_input(uart);
+    for (;;) {
+        int size = uart_read_bytes(uart, b->buff, BENCH_BUFF_SZ, 0);
+        if (size > 0 && bench_write(fd, b->buff, size) < 0)
+            break;
+        size = read(fd, b->buff, BENCH_BUFF_SZ);
+        if (size < 0)
+            break;
+        if (size > 0) {
+            uart_write_bytes(uart, (const char*)b->buff, size);
+            bytes += size;
+        } else
+            vTaskDelay(1);
+    }
+    bench_uart_loopback(uart, false);
+    ESP_LOGI(BENCH_TAG, "loop %u bytes", bytes);
+    return -1;
+}
+
+// Send pattern through UART internal loopback
+static int bench_uart(bench_state_t* b, int fd, uart_port_t uart, uint32_t bytes)
+{
+    struct bench_result r = {.test = "uart", .bytes = bytes};
+    uint32_t sent = 0, recvd = 0;
+    int64_t last_rx;
+    bench_uart_loopback(uart, true);
+    uart_flush_input(uart);
+    int64_t const start = last_rx = esp_timer_get_time();
+    while (recvd < bytes) {
+        if (sent < bytes && sent - recvd < BENCH_UART_WND) {
+            uint8_t chunk[64];
+            uint32_t n = bytes - sent;
+            if (n > sizeof(chunk))
+                n = sizeof(chunk);
+            for (uint32_t i = 0; i < n; ++i)
+                chunk[i] = bench_pattern(sent + i);
+            uart_write_bytes(uart, (const char*)chunk, n);
+            sent += n;
+        }
+        bool const wait = sent >= bytes || sent - recvd >= BENCH_UART_WND;
+        int const size = uart_read_bytes(uart, b->buff, BENCH_BUFF_SZ, wait ? 1 : 0);
+        int64_t const now = esp_timer_get_time();
+        if (size <= 0) {
+            if (now - last_rx > BENCH_TOUT_US) {
+                r.errors += bytes - recvd;
+                break;
+            }
+            continue;
+        }
+        last_rx = now;
+        for (int i = 0; i < size; ++i) {
+            if (b->buff[i] != bench_pattern(recvd + i))
+                ++r.errors;
+        }
+        recvd += size;
+    }
+    r.time_us = esp_timer_get_time() - start;
+    bench_uart_loopback(uart, false);
+    return bench_report(fd, &r);
+}
+
+// Send pattern to BT client
+static int bench_gen(bench_state_t* b, int fd, uint32_t bytes)
+{
+    struct bench_result r = {.test = "gen", .bytes = bytes};
+    int64_t const start = esp_timer_get_time();
+    for (uint32_t off = 0; off < bytes;) {
+        uint32_t n = bytes - off;
+        if (n > BENCH_BUFF_SZ)
+            n = BENCH_BUFF_SZ;
+        for (uint32_t i = 0; i < n; ++i)
+            b->buff[i] = bench_pattern(off + i);
+        if (bench_write(fd, b->buff, n) < 0)
+            return -1;
+        off += n;
+    }
+    r.time_us = esp_timer_get_time() - start;
+    return bench_report(fd, &r);
+}
+
+// Receive pattern from BT client
+static int bench_check(bench_state_t* b, int fd, uint32_t bytes)
+{
+    struct bench_result r = {.test = "check", .bytes = bytes};
+    uint32_t recvd = 0;
+    int64_t start = 0, last_rx = esp_timer_get_time();
+    while (recvd < bytes) {
+        uint32_t n = bytes - recvd;
+        if (n > BENCH_BUFF_SZ)
+            n = BENCH_BUFF_SZ;
+        int const size = read(fd, b->buff, n);
+        int64_t const now = esp_timer_get_time();
+        if (size < 0)
+            return -1;
+        if (!size) {
+            if (now - last_rx > BENCH_TOUT_US) {
+                r.errors += bytes - recvd;
+                break;
+            }
+            vTaskDelay(1);
+            continue;
+        }
+        if (!recvd)
+            start = now;
+        last_rx = now;
+        for (int i = 0; i < size; ++i) {
+            if (b->buff[i] != bench_pattern(recvd + i))
+                ++r.errors;
+        }
+        recvd += size;
+    }
+    r.time_us = last_rx - start;
+    return bench_report(fd, &r);
+}
+
+#ifdef BLE_ADAPTER_EN
+// Send test messages in the format expected by the web page: '#' + s + '_' + s
+static int bench_ble(int fd, uint32_t bytes)
+{
+    struct bench_result r = {.test = "ble"};
+    uint8_t msg[2 * BENCH_BLE_MSG + 2];
+    int64_t const start = esp_timer_get_time();
+    while (r.bytes < bytes) {
+        int const len = 1 + rand() % BENCH_BLE_MSG;
+        msg[0] = '#';
+        msg[1 + len] = '_';
+        for (int i = 0; i < len; ++i)
+            msg[1 + i] = msg[2 + len + i] = 'A' + rand() % 26;
+        if (!ble_server_send(msg, 2 * len + 2)) {
+            r.errors = 1;
+            break;
+        }
+        r.bytes += 2 * len + 2;
+        vTaskDelay(1);
+    }
+    r.time_us = esp_timer_get_time() - start;
+    return bench_report(fd, &r);
+}
+#endif
+
+void bench_run(bench_state_t* b, int fd, uart_port_t uart, const uint8_t* data, int size)
+{
+    ESP_LOGI(BENCH_TAG, "bench mode on UART%d", uart);
+    if (size > BENCH_LINE_MAX - 1)
+        size = BENCH_LINE_MAX - 1;
+    memcpy(b->line, data, size);
+    b->line_len = size;
+    for (;;) {
+        int const len = bench_read_line(b, fd);
+        if (len < 0)
+            break;
+        // Command is followed by optional byte count
+        char cmd[16] = "";
+        char* const arg = strchr(b->line, ' ');
+        if (arg)
+            *arg = 0;
+        strncpy(cmd, b->line, sizeof(cmd) - 1);
+        uint32_t const bytes = arg ? strtoul(arg + 1, NULL, 10) : 0;
+        bench_line_consume(b, len);
+        int res = 0;
+        if (!strcmp(cmd, "echo"))
+            res = bench_echo(b, fd);
+        else if (!strcmp(cmd, "loop"))
+            res = bench_loop(b, fd, uart);
+        else if (!strcmp(cmd, "uart"))
+            res = bench_uart(b, fd, uart, bytes);
+        else if (!strcmp(cmd, "gen"))
+            res = bench_gen(b, fd, bytes);
+        else if (!strcmp(cmd, "check"))
+            res = bench_check(b, fd, bytes);
+#ifdef BLE_ADAPTER_EN
+        else if (!strcmp(cmd, "ble"))
+            res = bench_ble(fd, bytes);
+#endif
+        else if (cmd[0] && strcmp(cmd, BENCH_CMD))
+            ESP_LOGW(BENCH_TAG, "unknown command: %s", cmd);
+        if (res < 0)
+            break;
+    }
+    ESP_LOGI(BENCH_TAG, "bench mode done");
+}
+
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_BENCH_EN
+#define BENCH_EN
+#endif
+
+#ifdef BENCH_EN
+
+// The benchmark runs on the data transfer task stack (the kconfig default is raised accordingly)
+#if CONFIG_DATA_TASK_STACK_SIZE < 3072
+#error "benchmark mode requires DATA_TASK_STACK_SIZE of at least 3072 bytes"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "driver/uart.h"
+
+/*
+ * Self benchmark mode. Entered for every SPP connection if the bench strap GPIO is pulled low on power on
+ * or by sending BENCH_CMD line as the first data after connecting (if enabled in config).
+ * In bench mode the client sends command lines terminated by '\n':
+ *   echo         - send back everything received from BT bypassing UART, runs till disconnect
+ *   loop         - bridge BT to UART with UART internal loopback enabled, runs till disconnect
+ *   uart <bytes> - send pattern through UART internal loopback and check it
+ *   gen <bytes>  - send pattern to BT client
+ *   check <bytes>- receive pattern from BT client and check it
+ *   ble <bytes>  - send test messages to BLE client
+ * Every finite test is completed by the report line sent to the client:
+ *   BENCH test=<name> bytes=<count> ms=<time> kbps=<rate> errors=<count>
+ * The pattern byte at offset i is (i ^ (i >> 8) ^ (i >> 16)) & 0xff.
+ */
+
+#define BENCH_CMD "+++BENCH"
+
+#define BENCH_BUFF_SZ   256
+#define BENCH_LINE_MAX  64
+
+// Bench session state, one per channel since the channels may run bench sessions concurrently
+typedef struct {
+    uint8_t buff[BENCH_BUFF_SZ];
+    // Command line reader state
+    char    line[BENCH_LINE_MAX];
+    int     line_len;
+} bench_state_t;
+
+static inline uint8_t bench_pattern(uint32_t i)
+{
+    return (uint8_t)(i ^ (i >> 8) ^ (i >> 16));
+}
+
+// Sample bench strap GPIO
+void bench_init(void);
+
+// Returns true if bench strap is active
+bool bench_strapped(void);
+
+// Returns true if the data received from client requests bench mode
+bool bench_requested(const uint8_t* data, int size);
+
+// Run bench session on connected client socket. Returns on disconnect.
+// The data already received from client may be passed to be interpreted as commands.
+void bench_run(bench_state_t* b, int fd, uart_port_t uart, const uint8_t* data, int size);
+
+#endif
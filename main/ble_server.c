@@ -14,6 +14,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
@@ -25,6 +26,10 @@
 #include "esp_bt_defs.h"
 #include "esp_bt_main.h"
 #include "main.h"
+#include "hot_log.h"
+#include "mem_report.h"
+#include "ble_shaper.h"
+#include "packetizer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,12 +37,20 @@
 
 #define GATTS_TABLE_TAG  "GATTS_SPP"
 
+#ifdef CONFIG_BLE_RETRANSMIT
+#define BLE_RTX_EN
+#endif
+
 // Attributes State Machine
 enum{
     SPP_IDX_SVC,
     SPP_IDX_SPP_DATA_NOTIFY_CHAR,
     SPP_IDX_SPP_DATA_NTY_VAL,
     SPP_IDX_SPP_DATA_NTF_CFG,
+#ifdef BLE_RTX_EN
+    SPP_IDX_SPP_CTRL_CHAR,
+    SPP_IDX_SPP_CTRL_VAL,
+#endif
 
     SPP_IDX_NB,
 };
@@ -47,11 +60,13 @@ enum{
 #define ESP_SPP_APP_ID              0x56
 #define SPP_SVC_INST_ID	            0
 #define SPP_DATA_MAX_LEN           (512)
+#define SPP_CTRL_MAX_LEN           (20)
 
 // SPP Service
 static const uint16_t spp_service_uuid = 0xFFE0;
 // Characteristic UUID
 #define ESP_GATT_UUID_SPP_DATA_NOTIFY       0xFFE1
+#define ESP_GATT_UUID_SPP_CTRL              0xFFE2
 
 #define BLE_ADV_NAME      CONFIG_DEV_NAME_BLE
 #define BLE_ADV_NAME_LEN (sizeof(BLE_ADV_NAME)-1)
@@ -73,8 +88,6 @@ static uint8_t spp_adv_data[BLE_ADV_NAME_OFF+BLE_ADV_NAME_LEN+DEV_NAME_SUFF_LEN]
 #endif
 
 static uint16_t spp_mtu_size = 23;
-static uint8_t  spp_seq = 0;
-static uint8_t  spp_seq_max = 15;
 static uint16_t spp_conn_id = 0xffff;
 static esp_gatt_if_t spp_gatts_if = 0xff;
 QueueHandle_t spp_uart_queue = NULL;
@@ -136,6 +149,14 @@ static const uint16_t spp_data_notify_uuid = ESP_GATT_UUID_SPP_DATA_NOTIFY;
 static const uint8_t  spp_data_notify_val[20] = {0x00};
 static const uint8_t  spp_data_notify_ccc[2] = {0x00, 0x00};
 
+#ifdef BLE_RTX_EN
+static const uint8_t char_prop_write = ESP_GATT_CHAR_PROP_BIT_WRITE|ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+
+// SPP Service - control characteristic, write&write without response
+static const uint16_t spp_ctrl_uuid = ESP_GATT_UUID_SPP_CTRL;
+static const uint8_t  spp_ctrl_val[1] = {0x00};
+#endif
+
 // Full HRS Database Description - Used to add attributes into the database
 static const esp_gatts_attr_db_t spp_gatt_db[SPP_IDX_NB] =
 {
@@ -158,6 +179,18 @@ static const esp_gatts_attr_db_t spp_gatt_db[SPP_IDX_NB] =
     [SPP_IDX_SPP_DATA_NTF_CFG]         =
     {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_client_config_uuid, ESP_GATT_PERM_READ|ESP_GATT_PERM_WRITE,
     sizeof(uint16_t),sizeof(spp_data_notify_ccc), (uint8_t *)spp_data_notify_ccc}},
+#ifdef BLE_RTX_EN
+
+    //SPP -  control characteristic Declaration
+    [SPP_IDX_SPP_CTRL_CHAR]            =
+    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
+    CHAR_DECLARATION_SIZE,CHAR_DECLARATION_SIZE, (uint8_t *)&char_prop_write}},
+
+    //SPP -  control characteristic Value
+    [SPP_IDX_SPP_CTRL_VAL]             =
+    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&spp_ctrl_uuid, ESP_GATT_PERM_WRITE,
+    SPP_CTRL_MAX_LEN, sizeof(spp_ctrl_val), (uint8_t *)spp_ctrl_val}},
+#endif
 };
 
 static uint8_t find_char_and_desr_index(uint16_t handle)
@@ -173,6 +206,260 @@ static uint8_t find_char_and_desr_index(uint16_t handle)
     return error;
 }
 
+#ifdef BLE_RTX_EN
+
+/*
+ * Selective retransmission. It is activated by the first write to the control characteristic
+ * so the clients unaware of it get plain notifications as before. Once activated the sent chunks
+ * are kept till the client acknowledges them. The control write content is:
+ *   [0]  - the tag of the last chunk received with all preceding ones or '.' if nothing received yet
+ *   [1:] - the tags of the missing chunks to be sent again
+ * The retransmitted chunks are tagged by upper case letters. The number of unacknowledged chunks
+ * is limited by half of the tag space so the client can tell stale duplicates from the new chunks.
+ * The unacknowledged chunks are sent again on timeout. If the client does not acknowledge them
+ * after several attempts they are given up so the sender is never blocked forever.
+ */
+
+#define BLE_RTX_WINDOW   8
+#define BLE_RTX_SLOT_SZ  PKT_CHUNK_MAX
+#define BLE_RTX_RETRIES  10
+#define BLE_RTX_TIMEOUT  (CONFIG_BLE_RETRANSMIT_TIMEOUT / portTICK_PERIOD_MS)
+#define BLE_RTX_NO_ACK   '.'
+
+#define RTX_SPACE BIT0
+#define RTX_NACK  BIT1
+
+struct ble_rtx_slot {
+    uint16_t len;
+    uint8_t  data[BLE_RTX_SLOT_SZ]; // data[0] is the tag
+};
+
+static struct ble_rtx_slot* rtx_slots;
+static bool      rtx_active;
+static uint8_t   rtx_seq;   // the sequence number of the next chunk sent
+static uint8_t   rtx_base;  // the sequence number of the oldest unacknowledged chunk
+static uint8_t   rtx_count; // the number of unacknowledged chunks
+static uint16_t  rtx_nack;  // the sequence numbers to be sent again bitmask
+static unsigned  rtx_retries;
+static unsigned  rtx_resent;
+static unsigned  rtx_given_up;
+
+static portMUX_TYPE rtx_mux = portMUX_INITIALIZER_UNLOCKED;
+static EventGroupHandle_t rtx_events;
+
+MEM_EVENTS_STORAGE(rtx);
+// The extra slot past the window holds the copy of the chunk being resent
+MEM_BUFF_STORAGE(rtx, (BLE_RTX_WINDOW + 1) * sizeof(struct ble_rtx_slot));
+MEM_TASK_STORAGE(rtx, 2048);
+
+static inline bool rtx_outstanding(uint8_t seq)
+{
+    return ((seq - rtx_base) & PKT_SEQ_MASK) < rtx_count;
+}
+
+// Called on control characteristic write
+static void ble_rtx_control(const uint8_t* data, int len)
+{
+    if (!rtx_slots) {
+        rtx_slots = MEM_BUFF_ALLOC(rtx);
+        if (!rtx_slots) {
+            ESP_LOGE(GATTS_TABLE_TAG, "%s malloc failed", __func__);
+            return;
+        }
+    }
+    EventBits_t evt = 0;
+    portENTER_CRITICAL(&rtx_mux);
+    if (!rtx_active) {
+        rtx_active = true;
+        rtx_seq = rtx_base = rtx_count = 0;
+        rtx_nack = 0;
+        rtx_retries = rtx_resent = rtx_given_up = 0;
+    }
+    if (len > 0 && data[0] != BLE_RTX_NO_ACK) {
+        uint8_t const seq = (data[0] - 'a') & PKT_SEQ_MASK;
+        if (rtx_outstanding(seq)) {
+            uint8_t const acked = ((seq - rtx_base) & PKT_SEQ_MASK) + 1;
+            rtx_base = (seq + 1) & PKT_SEQ_MASK;
+            rtx_count -= acked;
+            rtx_retries = 0;
+            evt |= RTX_SPACE;
+        }
+    }
+    for (int i = 1; i < len; ++i) {
+        uint8_t const seq = (data[i] - 'a') & PKT_SEQ_MASK;
+        if (rtx_outstanding(seq)) {
+            rtx_nack |= 1 << seq;
+            evt |= RTX_NACK;
+        }
+    }
+    portEXIT_CRITICAL(&rtx_mux);
+    if (evt)
+        xEventGroupSetBits(rtx_events, evt);
+}
+
+// Called for every chunk sent. The chunk is tagged by the retransmission sequence number
+// since it is restarted on activation. Returns false if retransmission is not active.
+static bool ble_rtx_send(uint8_t* chunk, int len)
+{
+    for (;;) {
+        portENTER_CRITICAL(&rtx_mux);
+        if (!rtx_active) {
+            portEXIT_CRITICAL(&rtx_mux);
+            return false;
+        }
+        if (rtx_count < BLE_RTX_WINDOW)
+            break;
+        portEXIT_CRITICAL(&rtx_mux);
+        xEventGroupWaitBits(rtx_events, RTX_SPACE, pdTRUE, pdFALSE, portMAX_DELAY);
+    }
+    struct ble_rtx_slot* const slot = &rtx_slots[rtx_seq % BLE_RTX_WINDOW];
+    pkt_set_tag(chunk, rtx_seq, false);
+    slot->len = len;
+    memcpy(slot->data, chunk, len);
+    ++rtx_count;
+    rtx_seq = (rtx_seq + 1) & PKT_SEQ_MASK;
+    portEXIT_CRITICAL(&rtx_mux);
+
+    esp_ble_gatts_send_indicate(spp_gatts_if, spp_conn_id, spp_handle_table[SPP_IDX_SPP_DATA_NTY_VAL], len, chunk, false);
+    return true;
+}
+
+static void ble_rtx_resend(uint16_t mask)
+{
+    for (uint8_t seq = 0; mask; ++seq, mask >>= 1) {
+        if (!(mask & 1))
+            continue;
+        // The slot is reused once acknowledged or given up, so the chunk is copied while it is outstanding
+        struct ble_rtx_slot* const copy = &rtx_slots[BLE_RTX_WINDOW];
+        portENTER_CRITICAL(&rtx_mux);
+        bool const resend = rtx_active && rtx_outstanding(seq);
+        if (resend) {
+            struct ble_rtx_slot const* const slot = &rtx_slots[seq % BLE_RTX_WINDOW];
+            copy->len = slot->len;
+            memcpy(copy->data, slot->data, slot->len);
+            ++rtx_resent;
+        }
+        portEXIT_CRITICAL(&rtx_mux);
+        if (resend) {
+            pkt_set_tag(copy->data, seq, true);
+            esp_ble_gatts_send_indicate(spp_gatts_if, spp_conn_id, spp_handle_table[SPP_IDX_SPP_DATA_NTY_VAL], copy->len, copy->data, false);
+        }
+    }
+}
+
+static void ble_rtx_task(void* param)
+{
+    for (;;) {
+        EventBits_t const evt = xEventGroupWaitBits(rtx_events, RTX_NACK, pdTRUE, pdFALSE, BLE_RTX_TIMEOUT);
+        uint16_t mask = 0;
+        unsigned given_up = 0;
+        portENTER_CRITICAL(&rtx_mux);
+        if (evt & RTX_NACK) {
+            mask = rtx_nack;
+            rtx_nack = 0;
+        } else if (!rtx_active || !rtx_count) {
+            rtx_retries = 0;
+        } else if (rtx_retries++) {
+            // No acknowledgement for the whole timeout period
+            if (rtx_retries > BLE_RTX_RETRIES) {
+                given_up = rtx_count;
+                rtx_given_up += given_up;
+                rtx_base = (rtx_base + rtx_count) & PKT_SEQ_MASK;
+                rtx_count = 0;
+                rtx_retries = 0;
+            } else {
+                for (uint8_t i = 0; i < rtx_count; ++i)
+                    mask |= 1 << ((rtx_base + i) & PKT_SEQ_MASK);
+            }
+        }
+        portEXIT_CRITICAL(&rtx_mux);
+        if (given_up) {
+            ESP_LOGW(GATTS_TABLE_TAG, "%u chunks not acknowledged, given up", given_up);
+            xEventGroupSetBits(rtx_events, RTX_SPACE);
+        }
+        ble_rtx_resend(mask);
+    }
+}
+
+static void ble_rtx_stop(void)
+{
+    portENTER_CRITICAL(&rtx_mux);
+    bool const was_active = rtx_active;
+    rtx_active = false;
+    rtx_count = 0;
+    portEXIT_CRITICAL(&rtx_mux);
+    xEventGroupSetBits(rtx_events, RTX_SPACE);
+    if (was_active)
+        ESP_LOGI(GATTS_TABLE_TAG, "%u chunks resent, %u given up", rtx_resent, rtx_given_up);
+}
+
+static void ble_rtx_init(void)
+{
+    rtx_events = MEM_EVENTS_CREATE(rtx);
+    MEM_TASK_CREATE(rtx, ble_rtx_task, "bleRtx", NULL, 8);
+}
+
+#endif
+
+/*
+ * The data is split to notifications by the packetizer. The UART data is pushed in pieces
+ * as it is read and the tail not filling the whole chunk is sent once the UART event data
+ * is complete. The send lock serializes the UART task and the bench mode sender.
+ */
+
+#define BLE_UART_RX_CHUNK 256
+
+static packetizer_t      spp_pkt;
+static SemaphoreHandle_t spp_send_lock;
+#ifdef STATIC_ALLOC_EN
+static StaticSemaphore_t spp_send_lock_buff;
+#endif
+static uint8_t*          spp_chunk;
+static uint8_t*          uart_rx_data;
+
+MEM_BUFF_STORAGE(spp_chunk, PKT_CHUNK_MAX);
+MEM_BUFF_STORAGE(uart_rx, BLE_UART_RX_CHUNK);
+
+// Send data by notifications. The end flag marks the end of the message so the last short chunk is sent.
+static bool ble_send(const uint8_t* data, int size, bool end)
+{
+    bool ok = false;
+    xSemaphoreTake(spp_send_lock, portMAX_DELAY);
+    if (!is_connected) {
+        ESP_LOGW(GATTS_TABLE_TAG, "%s not connected", __func__);
+        pkt_reset(&spp_pkt);
+    } else if (!enable_data_ntf) {
+        ESP_LOGW(GATTS_TABLE_TAG, "%s notify not enabled", __func__);
+        pkt_reset(&spp_pkt);
+    } else {
+        HOT_LOGD(GATTS_TABLE_TAG, "send %u / %u", size, spp_mtu_size);
+        pkt_push(&spp_pkt, data, size, end);
+        for (;;) {
+            // The MTU may be changed by client at any time
+            pkt_set_mtu(&spp_pkt, spp_mtu_size);
+            size_t const len = pkt_pull(&spp_pkt, spp_chunk);
+            if (!len)
+                break;
+            ble_shaper_wait(len);
+#ifdef BLE_RTX_EN
+            if (ble_rtx_send(spp_chunk, len))
+                continue;
+#endif
+            esp_ble_gatts_send_indicate(spp_gatts_if, spp_conn_id, spp_handle_table[SPP_IDX_SPP_DATA_NTY_VAL], len, spp_chunk, false);
+        }
+        ok = true;
+    }
+    xSemaphoreGive(spp_send_lock);
+    return ok;
+}
+
+bool ble_server_send(const uint8_t* data, int size)
+{
+    if (!is_connected || !enable_data_ntf)
+        return false;
+    return ble_send(data, size, true);
+}
+
 void uart_task(void *pvParameters)
 {
     for (;;) {
@@ -182,33 +469,11 @@ void uart_task(void *pvParameters)
             switch (event.type) {
             //Event of UART receving data
             case UART_DATA:
-                if (event.size) {
-                    uint8_t * const buff = (uint8_t*)malloc(1 + event.size);
-                    if (buff == NULL) {
-                        ESP_LOGE(GATTS_TABLE_TAG, "%s malloc.1 failed", __func__);
-                        break;
-                    }
-                    uart_read_bytes(BLE_UART_NUM, buff + 1, event.size, portMAX_DELAY);
-                    if (!is_connected) {
-                        ESP_LOGW(GATTS_TABLE_TAG, "%s not connected", __func__);
-                    } else if (!enable_data_ntf) {
-                        ESP_LOGW(GATTS_TABLE_TAG, "%s notify not enabled", __func__);
-                    } else {
-                        uint16_t const max_payload = spp_mtu_size - 3;
-                        uint16_t const max_chunk = max_payload - 1;
-                        int const nchunks = (event.size + max_chunk - 1) / max_chunk;
-                        int remain = event.size;
-                        ESP_LOGD(GATTS_TABLE_TAG, "%s %u / %u", __func__, event.size, max_chunk);
-                        for (int i = 0; i < nchunks; ++i) {
-                            int const chunk = remain <= max_chunk ? remain : max_chunk;
-                            uint8_t first_tag = 'a';
-                            buff[i*max_chunk] = first_tag + spp_seq;
-                            if (++spp_seq > spp_seq_max)
-                                spp_seq = 0;
-                            esp_ble_gatts_send_indicate(spp_gatts_if, spp_conn_id, spp_handle_table[SPP_IDX_SPP_DATA_NTY_VAL], 1 + chunk, &buff[i*max_chunk], false);
-                        }
-                    }
-                    free(buff);
+                for (int remain = event.size; remain > 0;) {
+                    int const len = remain < BLE_UART_RX_CHUNK ? remain : BLE_UART_RX_CHUNK;
+                    uart_read_bytes(BLE_UART_NUM, uart_rx_data, len, portMAX_DELAY);
+                    remain -= len;
+                    ble_send(uart_rx_data, len, !remain);
                 }
                 break;
             default:
@@ -219,8 +484,15 @@ void uart_task(void *pvParameters)
     vTaskDelete(NULL);
 }
 
+MEM_TASK_STORAGE(uart, CONFIG_BLE_UART_TASK_STACK_SIZE);
+
 static void spp_uart_init(void)
 {
+    uart_rx_data = MEM_BUFF_ALLOC(uart_rx);
+    if (!uart_rx_data) {
+        ESP_LOGE(GATTS_TABLE_TAG, "%s malloc failed", __func__);
+        return;
+    }
     uart_config_t uart_config = {
         .baud_rate = CONFIG_BLE_UART_BITRATE,
         .data_bits = UART_DATA_8_BITS,
@@ -236,7 +508,8 @@ static void spp_uart_init(void)
     ESP_ERROR_CHECK(uart_set_pin(BLE_UART_NUM, UART_PIN_NO_CHANGE, CONFIG_BLE_UART_RX_GPIO, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
     // Install UART driver, and get the queue.
     ESP_ERROR_CHECK(uart_driver_install(BLE_UART_NUM, 4096, 8192, 10, &spp_uart_queue, 0));
-    xTaskCreate(uart_task, "uTask", 2048, (void*)BLE_UART_NUM, 8, NULL);
+    mem_account(false, 4096 + 8192);
+    MEM_TASK_CREATE(uart, uart_task, "uTask", (void*)BLE_UART_NUM, 8);
 }
 
 static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
@@ -277,6 +550,12 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
         case ESP_GATTS_WRITE_EVT:
     	    res = find_char_and_desr_index(p_data->write.handle);
             if (p_data->write.is_prep == false){
+#ifdef BLE_RTX_EN
+                if (res == SPP_IDX_SPP_CTRL_VAL) {
+                    ble_rtx_control(p_data->write.value, p_data->write.len);
+                    break;
+                }
+#endif
                 ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_WRITE_EVT : handle = %d", res);
                 if (res == SPP_IDX_SPP_DATA_NTF_CFG) {
                     if(p_data->write.len == 2 && p_data->write.value[1] == 0x00) {
@@ -312,6 +591,10 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
     	case ESP_GATTS_DISCONNECT_EVT:
     	    is_connected = false;
     	    enable_data_ntf = false;
+#ifdef BLE_RTX_EN
+    	    ble_rtx_stop();
+#endif
+    	    ble_shaper_report();
     	    esp_ble_gap_start_advertising(&spp_adv_params);
     	    break;
     	case ESP_GATTS_OPEN_EVT:
@@ -368,6 +651,19 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
 
 void ble_server_init(void)
 {
+    spp_chunk = MEM_BUFF_ALLOC(spp_chunk);
+    if (!spp_chunk) {
+        ESP_LOGE(GATTS_TABLE_TAG, "%s malloc failed", __func__);
+        return;
+    }
+    pkt_init(&spp_pkt, PKT_HDR_TAG, spp_mtu_size);
+    mem_account(true, sizeof(spp_pkt));
+#ifdef STATIC_ALLOC_EN
+    spp_send_lock = xSemaphoreCreateMutexStatic(&spp_send_lock_buff);
+#else
+    spp_send_lock = xSemaphoreCreateMutex();
+#endif
+
     for (int i = 0; i < BLE_ADV_NAME_LEN; ++i)
         spp_adv_data[BLE_ADV_NAME_OFF+i] = BLE_ADV_NAME[i];
     get_device_name_suff((char*)&spp_adv_data[BLE_ADV_NAME_OFF+BLE_ADV_NAME_LEN]);
@@ -376,6 +672,9 @@ void ble_server_init(void)
     esp_ble_gap_register_callback(gap_event_handler);
     esp_ble_gatts_app_register(ESP_SPP_APP_ID);
 
+#ifdef BLE_RTX_EN
+    ble_rtx_init();
+#endif
     spp_uart_init();
 }
 
@@ -8,6 +8,12 @@
 
 #ifdef BLE_ADAPTER_EN
 
+#include <stdint.h>
+#include <stdbool.h>
+
 void ble_server_init(void);
 
+// Send data to the connected client. Returns false if not connected.
+bool ble_server_send(const uint8_t* data, int size);
+
 #endif
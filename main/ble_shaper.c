@@ -0,0 +1,176 @@
+#include "ble_shaper.h"
+
+#ifdef BLE_SHAPER_EN
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#define SHAPER_TAG "BLE_SHAPER"
+
+#define SHAPE_RATE        CONFIG_BLE_SHAPE_RATE      // bytes/sec, 0 - unlimited
+#define SHAPE_BURST       CONFIG_BLE_SHAPE_BURST     // token bucket depth, bytes
+#define SHAPE_BUSY_RATE   CONFIG_BLE_SHAPE_BUSY_RATE // bytes/sec while SPP traffic is heavy, 0 - pause
+#define SHAPE_HEAVY_RATE  (1024 * CONFIG_BLE_SHAPE_HEAVY_RATE) // SPP bytes/sec considered heavy
+#define SHAPE_SETUP_HOLD  (1000LL * CONFIG_BLE_SHAPE_SETUP_HOLD)
+#define SHAPE_IDLE_PERIOD (1000LL * CONFIG_BLE_SHAPE_IDLE_PERIOD)
+#define SHAPE_IDLE_ON     (SHAPE_IDLE_PERIOD * CONFIG_BLE_SHAPE_IDLE_DUTY / 100)
+#define SHAPE_HEAVY_WIN   100000LL  // SPP rate measuring window, usec
+#define SHAPE_HEAVY_HOLD  500000LL  // keep throttling after SPP traffic has dropped, usec
+
+struct ble_shaper_stats {
+    uint32_t sent;       // BLE bytes passed
+    uint32_t setup_ms;   // paused due to SPP connection setup
+    uint32_t idle_ms;    // paused to leave time for page scan
+    uint32_t busy_ms;    // throttled due to heavy SPP traffic
+    uint32_t rate_ms;    // throttled by rate limit
+    uint32_t spp_bytes;  // SPP bytes passed
+    uint32_t heavy_ms;   // heavy SPP traffic periods duration
+};
+
+enum shaper_state {
+    shaper_pass,
+    shaper_setup,
+    shaper_idle,
+    shaper_busy,
+    shaper_rate,
+};
+
+static portMUX_TYPE shaper_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t  setup_until;
+static int64_t  heavy_until;
+static int64_t  heavy_win_start;
+static uint32_t heavy_win_bytes;
+static int64_t  bucket_time;
+static int32_t  bucket_tokens = SHAPE_BURST;
+static int      spp_connected;
+static struct ble_shaper_stats stats;
+
+void ble_shaper_spp_setup(void)
+{
+    int64_t const until = esp_timer_get_time() + SHAPE_SETUP_HOLD;
+    portENTER_CRITICAL(&shaper_lock);
+    setup_until = until;
+    portEXIT_CRITICAL(&shaper_lock);
+}
+
+void ble_shaper_spp_connected(int cnt)
+{
+    portENTER_CRITICAL(&shaper_lock);
+    spp_connected = cnt;
+    portEXIT_CRITICAL(&shaper_lock);
+}
+
+void ble_shaper_spp_traffic(size_t size)
+{
+    portENTER_CRITICAL(&shaper_lock);
+    heavy_win_bytes += size;
+    stats.spp_bytes += size;
+    portEXIT_CRITICAL(&shaper_lock);
+}
+
+// Update heavy traffic state, called with lock held
+static void shaper_check_heavy(int64_t now)
+{
+    int64_t const elapsed = now - heavy_win_start;
+    if (elapsed < SHAPE_HEAVY_WIN)
+        return;
+    if (heavy_win_bytes * 1000000LL >= SHAPE_HEAVY_RATE * elapsed) {
+        if (heavy_until < now)
+            heavy_until = now;
+        int64_t const until = now + SHAPE_HEAVY_HOLD;
+        stats.heavy_ms += (until - heavy_until) / 1000;
+        heavy_until = until;
+    }
+    heavy_win_start = now;
+    heavy_win_bytes = 0;
+}
+
+// Returns the state and the time to wait in usec, called with lock held
+static enum shaper_state shaper_check(int64_t now, size_t size, int64_t* wait)
+{
+    if (now < setup_until) {
+        *wait = setup_until - now;
+        return shaper_setup;
+    }
+#if CONFIG_BLE_SHAPE_IDLE_DUTY < 100
+    if (!spp_connected) {
+        int64_t const phase = now % SHAPE_IDLE_PERIOD;
+        if (phase >= SHAPE_IDLE_ON) {
+            *wait = SHAPE_IDLE_PERIOD - phase;
+            return shaper_idle;
+        }
+    }
+#endif
+    shaper_check_heavy(now);
+    bool const heavy = now < heavy_until;
+    int32_t const rate = heavy ? SHAPE_BUSY_RATE : SHAPE_RATE;
+    if (!rate) {
+        if (heavy) {
+            *wait = heavy_until - now;
+            return shaper_busy;
+        }
+        return shaper_pass;
+    }
+    int64_t const tokens = bucket_tokens + (now - bucket_time) * rate / 1000000;
+    bucket_tokens = tokens < SHAPE_BURST ? tokens : SHAPE_BURST;
+    bucket_time = now;
+    // Let the chunk larger than bucket pass once it is full
+    int32_t const need = size < SHAPE_BURST ? size : SHAPE_BURST;
+    if (bucket_tokens >= need) {
+        bucket_tokens -= size;
+        return shaper_pass;
+    }
+    *wait = (need - bucket_tokens) * 1000000LL / rate;
+    return heavy ? shaper_busy : shaper_rate;
+}
+
+void ble_shaper_wait(size_t size)
+{
+    for (;;) {
+        int64_t wait = 0;
+        int64_t const now = esp_timer_get_time();
+        portENTER_CRITICAL(&shaper_lock);
+        enum shaper_state const st = shaper_check(now, size, &wait);
+        if (st == shaper_pass)
+            stats.sent += size;
+        portEXIT_CRITICAL(&shaper_lock);
+        if (st == shaper_pass)
+            return;
+        TickType_t ticks = wait / (1000 * portTICK_PERIOD_MS);
+        if (!ticks)
+            ticks = 1;
+        vTaskDelay(ticks);
+        uint32_t const waited = (esp_timer_get_time() - now) / 1000;
+        portENTER_CRITICAL(&shaper_lock);
+        switch (st) {
+        case shaper_setup:
+            stats.setup_ms += waited;
+            break;
+        case shaper_idle:
+            stats.idle_ms += waited;
+            break;
+        case shaper_busy:
+            stats.busy_ms += waited;
+            break;
+        default:
+            stats.rate_ms += waited;
+            break;
+        }
+        portEXIT_CRITICAL(&shaper_lock);
+    }
+}
+
+void ble_shaper_report(void)
+{
+    portENTER_CRITICAL(&shaper_lock);
+    struct ble_shaper_stats const st = stats;
+    portEXIT_CRITICAL(&shaper_lock);
+    ESP_LOGI(SHAPER_TAG, "BLE sent %u bytes, delayed by SPP setup %u ms, idle duty %u ms, heavy SPP %u ms, rate limit %u ms",
+        st.sent, st.setup_ms, st.idle_ms, st.busy_ms, st.rate_ms);
+    ESP_LOGI(SHAPER_TAG, "SPP passed %u bytes, heavy traffic %u ms", st.spp_bytes, st.heavy_ms);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "ble_server.h"
+
+#if defined(BLE_ADAPTER_EN) && defined(CONFIG_BLE_SHAPING)
+#define BLE_SHAPER_EN
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * BLE traffic shaper. BLE and classic bluetooth share the radio so BLE notifications are
+ * throttled to let SPP connections succeed and keep SPP throughput. The notifications are
+ * paused for a while after every SPP connection setup event, duty cycled while no SPP client
+ * is connected to leave the radio time for page scan, limited to the lower rate while SPP
+ * traffic is heavy, and limited by token bucket at all times if configured.
+ */
+
+#ifdef BLE_SHAPER_EN
+
+// Called by the BLE sender before sending size bytes. Blocks while BLE traffic is not allowed.
+void ble_shaper_wait(size_t size);
+
+// SPP connection setup event (pairing, connection open)
+void ble_shaper_spp_setup(void);
+
+// The number of SPP clients connected has changed
+void ble_shaper_spp_connected(int cnt);
+
+// Data passed through SPP connection
+void ble_shaper_spp_traffic(size_t size);
+
+// Print shaping statistics to debug output
+void ble_shaper_report(void);
+
+#else
+
+static inline void ble_shaper_wait(size_t size) {}
+static inline void ble_shaper_spp_setup(void) {}
+static inline void ble_shaper_spp_connected(int cnt) {}
+static inline void ble_shaper_spp_traffic(size_t size) {}
+static inline void ble_shaper_report(void) {}
+
+#endif
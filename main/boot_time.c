@@ -0,0 +1,59 @@
+#include "boot_time.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#define BOOT_TAG "BOOT"
+#define BOOT_STAGES_MAX 16
+
+struct boot_stage_rec {
+    const char* name;
+    int64_t     time;
+};
+
+static struct boot_stage_rec boot_stages[BOOT_STAGES_MAX];
+static int boot_nstages;
+static bool boot_reported;
+static portMUX_TYPE boot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void boot_print(int i)
+{
+    int64_t const t = boot_stages[i].time;
+    int64_t const last = i ? boot_stages[i - 1].time : 0;
+    ESP_LOGI(BOOT_TAG, "%-14s %6u.%03u ms (+%u.%03u ms)", boot_stages[i].name,
+        (unsigned)(t / 1000), (unsigned)(t % 1000), (unsigned)((t - last) / 1000), (unsigned)((t - last) % 1000));
+}
+
+void boot_stage(const char* name)
+{
+    int64_t const now = esp_timer_get_time();
+    int i = -1;
+    bool late = false;
+    portENTER_CRITICAL(&boot_lock);
+    if (boot_nstages < BOOT_STAGES_MAX) {
+        i = boot_nstages++;
+        boot_stages[i].name = name;
+        boot_stages[i].time = now;
+        late = boot_reported;
+    }
+    portEXIT_CRITICAL(&boot_lock);
+    // The stages completed after the report are printed as they come
+    if (late)
+        boot_print(i);
+}
+
+void boot_report(void)
+{
+    portENTER_CRITICAL(&boot_lock);
+    bool const reported = boot_reported;
+    boot_reported = true;
+    int const n = boot_nstages;
+    portEXIT_CRITICAL(&boot_lock);
+    if (reported)
+        return;
+    for (int i = 0; i < n; ++i)
+        boot_print(i);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+/*
+ * Boot time measurement. The stages are recorded with the time elapsed since the application
+ * start and printed at once when the SPP server becomes connectable. The stages completed
+ * later are printed as they come.
+ */
+
+// Record the completion of the named boot stage. The name must be a static string.
+void boot_stage(const char* name);
+
+// Print recorded stages. Only the first call has an effect.
+void boot_report(void);
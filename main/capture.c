@@ -0,0 +1,306 @@
+#include "capture.h"
+
+#ifdef CAPTURE_EN
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "mem_report.h"
+
+#define CAPTURE_TAG "CAPTURE"
+
+// Partition is located by subtype, see partitions.csv
+#define CAPTURE_PART_SUBTYPE 0x40
+
+#define CAPTURE_RAM_BUFF_SZ (1024 * CONFIG_CAPTURE_RAM_BUFF_SIZE)
+
+// The code execution from flash is suspended on both CPUs while erasing, tens of milliseconds per
+// 4KB sector, so the sectors ahead of the write pointer are erased only while the bridge is idle.
+// While data flows only the page writes are done. Once the erased area is used up the records are
+// dropped till the bridge is idle again. Every sector starts with header so the log start can be
+// found after reboot.
+#define CAPTURE_SECTOR_SZ   SPI_FLASH_SEC_SIZE
+#define CAPTURE_MAGIC       0x50434231 // '1BCP'
+#define CAPTURE_ERASE_AHEAD (1024 * CONFIG_CAPTURE_ERASE_AHEAD / CAPTURE_SECTOR_SZ) // sectors
+#define CAPTURE_IDLE_US     200000 // no records for that long means the bridge is idle
+#define CAPTURE_ERASE_TOUT  (20 / portTICK_PERIOD_MS) // the pause between idle sector erases
+
+// Records longer than that are split
+#define CAPTURE_REC_MAX   1024
+
+// Write accumulated data to flash when there is that much of it or on timeout
+#define CAPTURE_FLUSH_SZ    1024
+#define CAPTURE_FLUSH_TOUT  (1000 / portTICK_PERIOD_MS)
+
+struct capture_sector_hdr {
+    uint32_t magic;
+    uint32_t seq;   // sector sequence number, increments by 1 for every sector written
+    uint32_t boot;  // boot number
+};
+
+struct capture_rec_hdr {
+    uint32_t time_lo; // microseconds since boot
+    uint32_t time_hi;
+    uint16_t len;     // data length, 0xffff marks the end of records in sector
+    uint8_t  dir;
+    uint8_t  chan;
+};
+
+#define REC_ALIGN(sz) (((sz) + 3) & ~3)
+
+static const esp_partition_t* capture_part;
+static TaskHandle_t capture_task_handle;
+
+// RAM ring buffer, filled by capture_record, drained by the writer task
+static uint8_t*     ring;
+static size_t       ring_head;
+static size_t       ring_tail;
+static size_t       ring_used;
+static uint32_t     ring_dropped;
+static int64_t      ring_last_rec;  // the last record time
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Current sector image
+static uint8_t  sector[CAPTURE_SECTOR_SZ];
+static size_t   sector_len;      // bytes in the sector image
+static size_t   sector_written;  // bytes already written to flash
+static uint32_t sector_addr;     // sector offset in partition
+static uint32_t sector_seq;
+static uint32_t boot_num;
+static uint32_t erased_ahead;    // the number of erased sectors following the current one
+static uint32_t flash_dropped;   // records dropped since no erased sector was available
+
+static void ring_put(const void* data, size_t len)
+{
+    size_t chunk = CAPTURE_RAM_BUFF_SZ - ring_head;
+    if (chunk > len)
+        chunk = len;
+    memcpy(ring + ring_head, data, chunk);
+    memcpy(ring, (const uint8_t*)data + chunk, len - chunk);
+    ring_head = (ring_head + len) % CAPTURE_RAM_BUFF_SZ;
+}
+
+static void ring_get(void* data, size_t len)
+{
+    size_t chunk = CAPTURE_RAM_BUFF_SZ - ring_tail;
+    if (chunk > len)
+        chunk = len;
+    memcpy(data, ring + ring_tail, chunk);
+    memcpy((uint8_t*)data + chunk, ring, len - chunk);
+    ring_tail = (ring_tail + len) % CAPTURE_RAM_BUFF_SZ;
+}
+
+void capture_record(uint8_t dir, uint8_t chan, const uint8_t* data, size_t len)
+{
+    if (!ring)
+        return;
+    int64_t const now = esp_timer_get_time();
+    while (len) {
+        size_t const chunk = len < CAPTURE_REC_MAX ? len : CAPTURE_REC_MAX;
+        size_t const size = REC_ALIGN(sizeof(struct capture_rec_hdr) + chunk);
+        struct capture_rec_hdr const hdr = {
+            .time_lo = (uint32_t)now,
+            .time_hi = (uint32_t)(now >> 32),
+            .len = chunk,
+            .dir = dir,
+            .chan = chan,
+        };
+        bool dropped = false;
+        portENTER_CRITICAL(&ring_lock);
+        ring_last_rec = now;
+        if (ring_used + size > CAPTURE_RAM_BUFF_SZ) {
+            ++ring_dropped;
+            dropped = true;
+        } else {
+            ring_put(&hdr, sizeof(hdr));
+            ring_put(data, chunk);
+            ring_head = REC_ALIGN(ring_head) % CAPTURE_RAM_BUFF_SZ;
+            ring_used += size;
+        }
+        portEXIT_CRITICAL(&ring_lock);
+        if (dropped)
+            break;
+        data += chunk;
+        len -= chunk;
+    }
+    if (ring_used >= CAPTURE_FLUSH_SZ)
+        xTaskNotifyGive(capture_task_handle);
+}
+
+static void sector_flush(void)
+{
+    if (sector_written >= sector_len)
+        return;
+    esp_err_t const err = esp_partition_write(capture_part, sector_addr + sector_written,
+                                &sector[sector_written], sector_len - sector_written);
+    if (err != ESP_OK)
+        ESP_LOGE(CAPTURE_TAG, "write failed: %s", esp_err_to_name(err));
+    sector_written = sector_len;
+}
+
+static uint32_t sector_after(uint32_t addr, uint32_t cnt)
+{
+    return (addr + cnt * CAPTURE_SECTOR_SZ) % capture_part->size;
+}
+
+static bool sector_erase(uint32_t addr)
+{
+    esp_err_t const err = esp_partition_erase_range(capture_part, addr, CAPTURE_SECTOR_SZ);
+    if (err != ESP_OK)
+        ESP_LOGE(CAPTURE_TAG, "erase failed: %s", esp_err_to_name(err));
+    return err == ESP_OK;
+}
+
+// The current sector should be erased already
+static void sector_start(void)
+{
+    struct capture_sector_hdr const hdr = {
+        .magic = CAPTURE_MAGIC,
+        .seq = sector_seq,
+        .boot = boot_num,
+    };
+    memset(sector, 0xff, sizeof(sector));
+    memcpy(sector, &hdr, sizeof(hdr));
+    sector_len = sizeof(hdr);
+    sector_written = 0;
+}
+
+// Returns false if there is no erased sector to continue with
+static bool sector_next(void)
+{
+    sector_flush();
+    if (!erased_ahead)
+        return false;
+    --erased_ahead;
+    sector_addr = sector_after(sector_addr, 1);
+    ++sector_seq;
+    sector_start();
+    return true;
+}
+
+// Move records from RAM to the sector image
+static void capture_drain(void)
+{
+    for (;;) {
+        portENTER_CRITICAL(&ring_lock);
+        size_t const used = ring_used;
+        portEXIT_CRITICAL(&ring_lock);
+        if (!used)
+            break;
+        // Only this task consumes from the ring, so records may be read outside of the lock
+        struct capture_rec_hdr hdr;
+        size_t const tail = ring_tail;
+        ring_get(&hdr, sizeof(hdr));
+        ring_tail = tail;
+        size_t const size = REC_ALIGN(sizeof(hdr) + hdr.len);
+        if (sector_len + size > CAPTURE_SECTOR_SZ && !sector_next()) {
+            // Erasing now would stall the data path, so drop the record
+            ring_tail = (ring_tail + size) % CAPTURE_RAM_BUFF_SZ;
+            ++flash_dropped;
+        } else {
+            ring_get(&sector[sector_len], size);
+            sector_len += size;
+        }
+        portENTER_CRITICAL(&ring_lock);
+        ring_used -= size;
+        portEXIT_CRITICAL(&ring_lock);
+        if (sector_len - sector_written >= CAPTURE_FLUSH_SZ)
+            sector_flush();
+    }
+}
+
+// Find the most recent sector and continue after it
+static void capture_find_last(void)
+{
+    bool found = false;
+    for (uint32_t addr = 0; addr + CAPTURE_SECTOR_SZ <= capture_part->size; addr += CAPTURE_SECTOR_SZ) {
+        struct capture_sector_hdr hdr;
+        if (esp_partition_read(capture_part, addr, &hdr, sizeof(hdr)) != ESP_OK)
+            continue;
+        if (hdr.magic != CAPTURE_MAGIC)
+            continue;
+        if (!found || (int32_t)(hdr.seq - sector_seq) > 0) {
+            sector_seq = hdr.seq;
+            sector_addr = addr;
+            boot_num = hdr.boot;
+            found = true;
+        }
+    }
+    if (found) {
+        // Continue from the next sector
+        sector_addr = sector_after(sector_addr, 1);
+        ++sector_seq;
+        ++boot_num;
+    }
+}
+
+// Erase the next sector ahead if the bridge is idle. Returns true if there are more sectors to erase.
+static bool capture_erase_ahead(void)
+{
+    if (erased_ahead >= CAPTURE_ERASE_AHEAD)
+        return false;
+    portENTER_CRITICAL(&ring_lock);
+    bool const idle = !ring_used && esp_timer_get_time() - ring_last_rec >= CAPTURE_IDLE_US;
+    portEXIT_CRITICAL(&ring_lock);
+    if (!idle)
+        return true;
+    if (sector_erase(sector_after(sector_addr, erased_ahead + 1)))
+        ++erased_ahead;
+    return erased_ahead < CAPTURE_ERASE_AHEAD;
+}
+
+static void capture_task(void* param)
+{
+    uint32_t last_dropped = 0, last_flash_dropped = 0;
+    // Flash erase may take a while so do it here rather than on init
+    capture_find_last();
+    sector_erase(sector_addr);
+    sector_start();
+    ESP_LOGI(CAPTURE_TAG, "capture to %s at 0x%x, boot #%u", capture_part->label, capture_part->address + sector_addr, boot_num);
+    TickType_t wait = 0;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        capture_drain();
+        sector_flush();
+        wait = capture_erase_ahead() ? CAPTURE_ERASE_TOUT : CAPTURE_FLUSH_TOUT;
+        if (ring_dropped != last_dropped) {
+            ESP_LOGW(CAPTURE_TAG, "%u records dropped, RAM buffer full", ring_dropped - last_dropped);
+            last_dropped = ring_dropped;
+        }
+        if (flash_dropped != last_flash_dropped) {
+            ESP_LOGW(CAPTURE_TAG, "%u records dropped, no erased flash", flash_dropped - last_flash_dropped);
+            last_flash_dropped = flash_dropped;
+        }
+    }
+}
+
+MEM_BUFF_STORAGE(capture, CAPTURE_RAM_BUFF_SZ);
+MEM_TASK_STORAGE(capture, 2048);
+
+void capture_init(void)
+{
+    capture_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, CAPTURE_PART_SUBTYPE, NULL);
+    if (!capture_part) {
+        ESP_LOGE(CAPTURE_TAG, "capture partition not found");
+        return;
+    }
+    if (capture_part->size < (CAPTURE_ERASE_AHEAD + 2) * CAPTURE_SECTOR_SZ || capture_part->size % CAPTURE_SECTOR_SZ) {
+        ESP_LOGE(CAPTURE_TAG, "capture partition should have %u or more sectors of %u bytes",
+            CAPTURE_ERASE_AHEAD + 2, CAPTURE_SECTOR_SZ);
+        return;
+    }
+    uint8_t* const buff = MEM_BUFF_ALLOC(capture);
+    if (!buff) {
+        ESP_LOGE(CAPTURE_TAG, "%s malloc failed", __func__);
+        return;
+    }
+    capture_task_handle = MEM_TASK_CREATE(capture, capture_task, "capture", NULL, 2);
+    // Recording starts once the writer task is created
+    ring = buff;
+}
+
+#endif
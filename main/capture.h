@@ -0,0 +1,35 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_CAPTURE_EN
+#define CAPTURE_EN
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Bridge traffic recorder. The data passed through the bridge is copied together with timestamp
+ * and direction tag to the RAM buffer. The background task writes it to the dedicated flash partition
+ * used as circular log. See tools/capture_dump.py for decoding.
+ */
+
+// Direction tags
+#define CAPTURE_UART_TO_BT 0
+#define CAPTURE_BT_TO_UART 1
+
+#ifdef CAPTURE_EN
+
+// Find capture partition and start writer task
+void capture_init(void);
+
+// Record data chunk. Never blocks, the data is dropped if the RAM buffer is full.
+void capture_record(uint8_t dir, uint8_t chan, const uint8_t* data, size_t len);
+
+#else
+
+static inline void capture_init(void) {}
+static inline void capture_record(uint8_t dir, uint8_t chan, const uint8_t* data, size_t len) {}
+
+#endif
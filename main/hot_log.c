@@ -0,0 +1,117 @@
+#include "hot_log.h"
+
+#if HOT_LOG_LEVEL > 0
+
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mem_report.h"
+
+#define HOT_LOG_TAG "HOT_LOG"
+
+#define HOT_LOG_RING_SZ   (1 << CONFIG_HOT_LOG_RING_ORDER)
+#define HOT_LOG_RING_MASK (HOT_LOG_RING_SZ - 1)
+#define HOT_LOG_POLL_MS   20
+
+// Bounded multi-producer queue. Every cell has sequence number telling whether it is free
+// for the producer with the given enqueue position or holds the record for the consumer.
+struct hot_log_cell {
+    uint32_t        seq;
+    uint32_t        time;
+    const char*     tag;
+    const char*     fmt;
+    uint32_t        args[2];
+    esp_log_level_t level;
+};
+
+static struct hot_log_cell hot_log_ring[HOT_LOG_RING_SZ];
+static uint32_t hot_log_enq;
+static uint32_t hot_log_deq;
+static uint32_t hot_log_dropped;
+
+void hot_log_put(esp_log_level_t level, const char* tag, const char* fmt, uint32_t a, uint32_t b)
+{
+    struct hot_log_cell* cell;
+    uint32_t pos = __atomic_load_n(&hot_log_enq, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &hot_log_ring[pos & HOT_LOG_RING_MASK];
+        uint32_t const seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int32_t const dif = (int32_t)(seq - pos);
+        if (!dif) {
+            if (__atomic_compare_exchange_n(&hot_log_enq, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            // Full
+            __atomic_fetch_add(&hot_log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&hot_log_enq, __ATOMIC_RELAXED);
+        }
+    }
+    cell->time = esp_log_timestamp();
+    cell->tag = tag;
+    cell->fmt = fmt;
+    cell->args[0] = a;
+    cell->args[1] = b;
+    cell->level = level;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static bool hot_log_get(struct hot_log_cell* rec)
+{
+    struct hot_log_cell* const cell = &hot_log_ring[hot_log_deq & HOT_LOG_RING_MASK];
+    uint32_t const seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    if (seq != hot_log_deq + 1)
+        return false;
+    *rec = *cell;
+    __atomic_store_n(&cell->seq, hot_log_deq + HOT_LOG_RING_SZ, __ATOMIC_RELEASE);
+    ++hot_log_deq;
+    return true;
+}
+
+static char hot_log_letter(esp_log_level_t level)
+{
+    switch (level) {
+    case ESP_LOG_ERROR:
+        return 'E';
+    case ESP_LOG_WARN:
+        return 'W';
+    case ESP_LOG_INFO:
+        return 'I';
+    case ESP_LOG_DEBUG:
+        return 'D';
+    default:
+        return 'V';
+    }
+}
+
+static void hot_log_task(void* param)
+{
+    uint32_t last_dropped = 0;
+    for (;;) {
+        struct hot_log_cell rec;
+        while (hot_log_get(&rec)) {
+            esp_log_write(rec.level, rec.tag, "%c (%u) %s: ", hot_log_letter(rec.level), rec.time, rec.tag);
+            esp_log_write(rec.level, rec.tag, rec.fmt, rec.args[0], rec.args[1]);
+            esp_log_write(rec.level, rec.tag, "\n");
+        }
+        uint32_t const dropped = __atomic_load_n(&hot_log_dropped, __ATOMIC_RELAXED);
+        if (dropped != last_dropped) {
+            ESP_LOGW(HOT_LOG_TAG, "%u records dropped", dropped - last_dropped);
+            last_dropped = dropped;
+        }
+        vTaskDelay(HOT_LOG_POLL_MS / portTICK_PERIOD_MS);
+    }
+}
+
+MEM_TASK_STORAGE(hot_log, 2048);
+
+void hot_log_init(void)
+{
+    for (uint32_t i = 0; i < HOT_LOG_RING_SZ; ++i)
+        hot_log_ring[i].seq = i;
+    mem_account(true, sizeof(hot_log_ring));
+    MEM_TASK_CREATE(hot_log, hot_log_task, "hotLog", NULL, 1);
+}
+
+#endif
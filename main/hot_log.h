@@ -0,0 +1,79 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+/*
+ * Deferred logger for the data path. The log sites below CONFIG_HOT_LOG_LEVEL compile to nothing.
+ * The enabled ones put compact binary record (format string pointer and up to 2 integer arguments,
+ * more arguments are compile error)
+ * to the lock-free ring buffer. The records are formatted and printed later by the low priority task,
+ * so logging does not slow down the data transfer. The format string must be a literal.
+ * If the ring is full the record is dropped, the number of dropped records is reported.
+ */
+
+#include <stdint.h>
+#include "esp_log.h"
+
+#ifdef CONFIG_HOT_LOG_LEVEL
+#define HOT_LOG_LEVEL CONFIG_HOT_LOG_LEVEL
+#else
+#define HOT_LOG_LEVEL 0
+#endif
+
+// The number of the variadic arguments (up to 8)
+#define HOT_LOG_NARGS(...) HOT_LOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define HOT_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+// The record has room for 2 arguments only, the extra ones would be silently lost
+#define HOT_LOG_CHECK_ARGS(...) \
+    _Static_assert(HOT_LOG_NARGS(__VA_ARGS__) <= 2, "hot log takes at most 2 arguments")
+
+#if HOT_LOG_LEVEL > 0
+
+void hot_log_init(void);
+void hot_log_put(esp_log_level_t level, const char* tag, const char* fmt, uint32_t a, uint32_t b);
+
+#define HOT_LOG_PUT_(level, tag, fmt, a, b, ...) hot_log_put(level, tag, fmt, (uint32_t)(a), (uint32_t)(b))
+#define HOT_LOG_PUT(level, tag, fmt, ...) do { \
+    HOT_LOG_CHECK_ARGS(__VA_ARGS__); \
+    HOT_LOG_PUT_(level, tag, fmt, ##__VA_ARGS__, 0, 0); \
+} while (0)
+
+#else
+
+static inline void hot_log_init(void) {}
+
+#endif
+
+// The disabled log sites are checked as well so the error does not depend on the configured level
+#define HOT_LOG_NONE(tag, fmt, ...) do { HOT_LOG_CHECK_ARGS(__VA_ARGS__); } while (0)
+
+#if HOT_LOG_LEVEL >= 1
+#define HOT_LOGE(tag, fmt, ...) HOT_LOG_PUT(ESP_LOG_ERROR, tag, fmt, ##__VA_ARGS__)
+#else
+#define HOT_LOGE HOT_LOG_NONE
+#endif
+
+#if HOT_LOG_LEVEL >= 2
+#define HOT_LOGW(tag, fmt, ...) HOT_LOG_PUT(ESP_LOG_WARN, tag, fmt, ##__VA_ARGS__)
+#else
+#define HOT_LOGW HOT_LOG_NONE
+#endif
+
+#if HOT_LOG_LEVEL >= 3
+#define HOT_LOGI(tag, fmt, ...) HOT_LOG_PUT(ESP_LOG_INFO, tag, fmt, ##__VA_ARGS__)
+#else
+#define HOT_LOGI HOT_LOG_NONE
+#endif
+
+#if HOT_LOG_LEVEL >= 4
+#define HOT_LOGD(tag, fmt, ...) HOT_LOG_PUT(ESP_LOG_DEBUG, tag, fmt, ##__VA_ARGS__)
+#else
+#define HOT_LOGD HOT_LOG_NONE
+#endif
+
+#if HOT_LOG_LEVEL >= 5
+#define HOT_LOGV(tag, fmt, ...) HOT_LOG_PUT(ESP_LOG_VERBOSE, tag, fmt, ##__VA_ARGS__)
+#else
+#define HOT_LOGV HOT_LOG_NONE
+#endif
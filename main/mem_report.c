@@ -0,0 +1,153 @@
+#include "mem_report.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+
+#define MEM_TAG "MEM"
+
+#define MEM_TASKS_MAX 16
+
+struct mem_task {
+    const char*  name;
+    TaskHandle_t handle;    // NULL if the task has exited
+    uint32_t     stack_sz;
+    uint32_t     min_free;  // stack high water mark of the exited task instances
+    bool         is_static;
+};
+
+static struct mem_task mem_tasks[MEM_TASKS_MAX];
+static size_t  mem_static;
+static size_t  mem_heap;
+static size_t  mem_heap_baseline;
+static portMUX_TYPE mem_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void mem_report_init(void)
+{
+    mem_heap_baseline = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+void mem_account(bool is_static, size_t size)
+{
+    portENTER_CRITICAL(&mem_lock);
+    if (is_static)
+        mem_static += size;
+    else
+        mem_heap += size;
+    portEXIT_CRITICAL(&mem_lock);
+}
+
+void* mem_alloc(size_t size)
+{
+    void* const p = malloc(size);
+    if (p)
+        mem_account(false, size);
+    return p;
+}
+
+static struct mem_task* mem_task_slot(const char* name)
+{
+    struct mem_task* free_slot = NULL;
+    for (int i = 0; i < MEM_TASKS_MAX; ++i) {
+        struct mem_task* const t = &mem_tasks[i];
+        if (!t->name) {
+            if (!free_slot)
+                free_slot = t;
+        } else if (!t->handle && !strcmp(t->name, name)) {
+            // Reuse the slot of the exited task with the same name
+            return t;
+        }
+    }
+    return free_slot;
+}
+
+TaskHandle_t mem_task_create(TaskFunction_t fn, const char* name, uint32_t stack_sz, void* param, UBaseType_t prio,
+                             StackType_t* stack, StaticTask_t* tcb)
+{
+    TaskHandle_t handle = NULL;
+#ifdef STATIC_ALLOC_EN
+    if (stack) {
+        handle = xTaskCreateStatic(fn, name, stack_sz, param, prio, stack, tcb);
+        if (handle)
+            mem_account(true, stack_sz + sizeof(*tcb));
+    } else
+#endif
+    xTaskCreate(fn, name, stack_sz, param, prio, &handle);
+    if (!handle) {
+        ESP_LOGE(MEM_TAG, "failed to create %s task", name);
+        return NULL;
+    }
+    portENTER_CRITICAL(&mem_lock);
+    struct mem_task* const t = mem_task_slot(name);
+    if (t) {
+        if (!t->name)
+            t->min_free = stack_sz;
+        t->name = name;
+        t->handle = handle;
+        t->stack_sz = stack_sz;
+        t->is_static = stack != NULL;
+    }
+    portEXIT_CRITICAL(&mem_lock);
+    return handle;
+}
+
+static void mem_task_unregister(TaskHandle_t handle)
+{
+    // The high water mark is taken under the lock so mem_report() never reads the stack of deleted task
+    portENTER_CRITICAL(&mem_lock);
+    for (int i = 0; i < MEM_TASKS_MAX; ++i) {
+        struct mem_task* const t = &mem_tasks[i];
+        if (t->name && t->handle == handle) {
+            uint32_t const free = uxTaskGetStackHighWaterMark(handle);
+            if (free < t->min_free)
+                t->min_free = free;
+            t->handle = NULL;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&mem_lock);
+}
+
+void mem_task_exit(void)
+{
+    mem_task_unregister(xTaskGetCurrentTaskHandle());
+}
+
+void mem_task_delete(TaskHandle_t handle)
+{
+    mem_task_unregister(handle);
+    vTaskDelete(handle);
+}
+
+void mem_report(void)
+{
+    ESP_LOGI(MEM_TAG, "task          stack  min free");
+    size_t task_heap = 0;
+    for (int i = 0; i < MEM_TASKS_MAX; ++i) {
+        // The task can't unregister and delete itself while the lock is held so its handle stays valid
+        portENTER_CRITICAL(&mem_lock);
+        struct mem_task const t = mem_tasks[i];
+        uint32_t free = t.min_free;
+        if (t.name && t.handle) {
+            uint32_t const cur = uxTaskGetStackHighWaterMark(t.handle);
+            if (cur < free)
+                free = cur;
+        }
+        portEXIT_CRITICAL(&mem_lock);
+        if (!t.name)
+            continue;
+        if (t.handle && !t.is_static)
+            task_heap += t.stack_sz;
+        ESP_LOGI(MEM_TAG, "%-12s %6u %9u%s%s", t.name, t.stack_sz, free,
+            t.is_static ? " static" : "", t.handle ? "" : " exited");
+    }
+    size_t const heap_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t const heap_used = mem_heap_baseline > heap_free ? mem_heap_baseline - heap_free : 0;
+    size_t const bridge_heap = mem_heap + task_heap;
+    ESP_LOGI(MEM_TAG, "bridge static %u, heap %u bytes (task stacks %u)", mem_static, bridge_heap, task_heap);
+    ESP_LOGI(MEM_TAG, "heap used since start %u, by bluetooth stack and drivers %u bytes",
+        heap_used, heap_used > bridge_heap ? heap_used - bridge_heap : 0);
+    ESP_LOGI(MEM_TAG, "heap free %u, min free %u, largest free block %u bytes",
+        heap_free, heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
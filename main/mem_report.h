@@ -0,0 +1,92 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/event_groups.h"
+
+#ifdef CONFIG_STATIC_ALLOC
+#define STATIC_ALLOC_EN
+#endif
+
+/*
+ * Memory budget report. The bridge tasks, queues and buffers are created by the helpers below
+ * so the report can show the task stack high water marks and the memory taken by the bridge
+ * statically and from heap. With static allocation enabled the storage is reserved at build time
+ * and the corresponding heap headroom may be given to larger data buffers. The UART driver and
+ * bluetooth stack allocate their memory from heap in either case.
+ */
+
+// Call it first on startup to get the heap size baseline
+void mem_report_init(void);
+
+// Print memory report to debug output
+void mem_report(void);
+
+// Account for memory taken by the bridge objects not created by the helpers below
+void mem_account(bool is_static, size_t size);
+
+// Allocate memory from heap and account for it. Returns NULL on failure.
+void* mem_alloc(size_t size);
+
+TaskHandle_t mem_task_create(TaskFunction_t fn, const char* name, uint32_t stack_sz, void* param, UBaseType_t prio,
+                             StackType_t* stack, StaticTask_t* tcb);
+
+// Called by the task before deleting itself
+void mem_task_exit(void);
+
+// Delete the other task created by mem_task_create()
+void mem_task_delete(TaskHandle_t handle);
+
+#ifdef STATIC_ALLOC_EN
+
+#define MEM_TASK_STORAGE(var, stack_sz) \
+    static StackType_t var##_task_stack[stack_sz]; \
+    static StaticTask_t var##_task_tcb
+#define MEM_TASK_CREATE(var, fn, name, param, prio) \
+    mem_task_create(fn, name, sizeof(var##_task_stack), param, prio, var##_task_stack, &var##_task_tcb)
+
+#define MEM_BUFF_STORAGE(var, sz) \
+    static uint8_t var##_buff[sz] __attribute__((aligned(4)))
+#define MEM_BUFF_ALLOC(var) \
+    (mem_account(true, sizeof(var##_buff)), (void*)var##_buff)
+
+#define MEM_QUEUE_STORAGE(var, len, item_sz) \
+    static uint8_t var##_queue_items[(len) * (item_sz)]; \
+    static StaticQueue_t var##_queue_buff
+#define MEM_QUEUE_CREATE(var, len, item_sz) \
+    (mem_account(true, sizeof(var##_queue_items) + sizeof(var##_queue_buff)), xQueueCreateStatic(len, item_sz, var##_queue_items, &var##_queue_buff))
+
+#define MEM_EVENTS_STORAGE(var) \
+    static StaticEventGroup_t var##_events_buff
+#define MEM_EVENTS_CREATE(var) \
+    (mem_account(true, sizeof(var##_events_buff)), xEventGroupCreateStatic(&var##_events_buff))
+
+#else
+
+#define MEM_TASK_STORAGE(var, stack_sz) \
+    enum { var##_task_stack_sz = stack_sz }
+#define MEM_TASK_CREATE(var, fn, name, param, prio) \
+    mem_task_create(fn, name, var##_task_stack_sz, param, prio, NULL, NULL)
+
+#define MEM_BUFF_STORAGE(var, sz) \
+    enum { var##_buff_sz = sz }
+#define MEM_BUFF_ALLOC(var) \
+    mem_alloc(var##_buff_sz)
+
+#define MEM_QUEUE_STORAGE(var, len, item_sz) \
+    enum { var##_queue_sz = (len) * (item_sz) }
+#define MEM_QUEUE_CREATE(var, len, item_sz) \
+    (mem_account(false, var##_queue_sz + sizeof(StaticQueue_t)), xQueueCreate(len, item_sz))
+
+#define MEM_EVENTS_STORAGE(var) \
+    enum { var##_events_sz = sizeof(StaticEventGroup_t) }
+#define MEM_EVENTS_CREATE(var) \
+    (mem_account(false, var##_events_sz), xEventGroupCreate())
+
+#endif
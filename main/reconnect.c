@@ -0,0 +1,82 @@
+#include "reconnect.h"
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#define RECONNECT_TAG "RECONNECT"
+#define RECONNECT_CHANNELS 2 // the maximum number of bridged channels
+
+struct reconnect_chan {
+    int64_t open_time;   // zero if the first byte was already transferred
+    int64_t closed_time; // zero if never connected
+};
+
+static struct reconnect_chan reconnect_chans[RECONNECT_CHANNELS];
+
+// Time to first byte statistics
+static unsigned reconnect_cnt;
+static int64_t  reconnect_ttfb_sum;
+static int64_t  reconnect_ttfb_min;
+static int64_t  reconnect_ttfb_max;
+static portMUX_TYPE reconnect_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_bt_scan_mode_t reconnect_scan_mode(void)
+{
+#ifdef CONFIG_FAST_RECONNECT_HIDDEN
+    int const bonded = esp_bt_gap_get_bond_device_num();
+    if (bonded > 0) {
+        ESP_LOGI(RECONNECT_TAG, "%d bonded, not discoverable", bonded);
+        return ESP_BT_SCAN_MODE_CONNECTABLE;
+    }
+#endif
+    return ESP_BT_SCAN_MODE_CONNECTABLE_DISCOVERABLE;
+}
+
+void reconnect_open(int ch)
+{
+    struct reconnect_chan* const c = &reconnect_chans[ch];
+    int64_t const now = esp_timer_get_time();
+    if (c->closed_time) {
+        int64_t const gap = now - c->closed_time;
+        ESP_LOGI(RECONNECT_TAG, "channel %d reconnected after %u ms", ch, (unsigned)(gap / 1000));
+    }
+    portENTER_CRITICAL(&reconnect_lock);
+    c->open_time = now;
+    portEXIT_CRITICAL(&reconnect_lock);
+}
+
+void reconnect_first_byte(int ch)
+{
+    struct reconnect_chan* const c = &reconnect_chans[ch];
+    int64_t const now = esp_timer_get_time();
+    portENTER_CRITICAL(&reconnect_lock);
+    int64_t const ttfb = c->open_time ? now - c->open_time : -1;
+    c->open_time = 0;
+    if (ttfb >= 0) {
+        if (!reconnect_cnt || ttfb < reconnect_ttfb_min)
+            reconnect_ttfb_min = ttfb;
+        if (!reconnect_cnt || ttfb > reconnect_ttfb_max)
+            reconnect_ttfb_max = ttfb;
+        reconnect_ttfb_sum += ttfb;
+        ++reconnect_cnt;
+    }
+    unsigned const cnt = reconnect_cnt;
+    int64_t const avg = cnt ? reconnect_ttfb_sum / cnt : 0;
+    int64_t const min = reconnect_ttfb_min, max = reconnect_ttfb_max;
+    portEXIT_CRITICAL(&reconnect_lock);
+    if (ttfb < 0)
+        return;
+    ESP_LOGI(RECONNECT_TAG, "channel %d first byte after %u.%03u ms (min %u.%03u avg %u.%03u max %u.%03u ms of %u)", ch,
+        (unsigned)(ttfb / 1000), (unsigned)(ttfb % 1000), (unsigned)(min / 1000), (unsigned)(min % 1000),
+        (unsigned)(avg / 1000), (unsigned)(avg % 1000), (unsigned)(max / 1000), (unsigned)(max % 1000), cnt);
+}
+
+void reconnect_closed(int ch)
+{
+    struct reconnect_chan* const c = &reconnect_chans[ch];
+    portENTER_CRITICAL(&reconnect_lock);
+    c->open_time = 0;
+    c->closed_time = esp_timer_get_time();
+    portEXIT_CRITICAL(&reconnect_lock);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_FAST_RECONNECT
+#define FAST_RECONNECT_EN
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_gap_bt_api.h"
+
+/*
+ * SPP reconnection. The time from the connection open to the first data byte transferred is
+ * measured on every connection and printed to the debug output together with the time the
+ * channel was disconnected. In the fast reconnect mode the device may be hidden from discovery
+ * once it has bonded hosts.
+ * All functions except reconnect_first_byte() and reconnect_closed() are called by SPP event task.
+ */
+
+// The scan mode to be set on SPP initialization
+esp_bt_scan_mode_t reconnect_scan_mode(void);
+
+// The client has opened connection to the channel
+void reconnect_open(int ch);
+
+// The first data byte is transferred through the channel since the connection was open
+void reconnect_first_byte(int ch);
+
+// The channel is disconnected
+void reconnect_closed(int ch);
@@ -22,6 +22,7 @@
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "spp_task.h"
+#include "mem_report.h"
 
 static void spp_task_task_handler(void *arg);
 static bool spp_task_send_msg(spp_task_msg_t *msg);
@@ -30,6 +31,9 @@ static void spp_task_work_dispatched(spp_task_msg_t *msg);
 static xQueueHandle spp_task_task_queue = NULL;
 static xTaskHandle spp_task_task_handle = NULL;
 
+MEM_QUEUE_STORAGE(spp_msg, 10, sizeof(spp_task_msg_t));
+MEM_TASK_STORAGE(spp_task, CONFIG_SPP_TASK_STACK_SIZE);
+
 bool spp_task_work_dispatch(spp_task_cb_t p_cback, uint16_t event, void *p_params, int param_len, spp_task_copy_cb_t p_copy_cback)
 {
     ESP_LOGD(SPP_TASK_TAG, "%s event 0x%x, param len %d", __func__, event, param_len);
@@ -101,15 +105,15 @@ static void spp_task_task_handler(void *arg)
 
 void spp_task_task_start_up(void)
 {
-    spp_task_task_queue = xQueueCreate(10, sizeof(spp_task_msg_t));
-    xTaskCreate(spp_task_task_handler, "SPPAppT", 2048, NULL, 10, spp_task_task_handle);
+    spp_task_task_queue = MEM_QUEUE_CREATE(spp_msg, 10, sizeof(spp_task_msg_t));
+    spp_task_task_handle = MEM_TASK_CREATE(spp_task, spp_task_task_handler, "SPPAppT", NULL, 10);
     return;
 }
 
 void spp_task_task_shut_down(void)
 {
     if (spp_task_task_handle) {
-        vTaskDelete(spp_task_task_handle);
+        mem_task_delete(spp_task_task_handle);
         spp_task_task_handle = NULL;
     }
     if (spp_task_task_queue) {
@@ -118,12 +122,14 @@ void spp_task_task_shut_down(void)
     }
 }
 
-void spp_wr_task_start_up(spp_wr_task_cb_t p_cback, int fd)
+bool spp_wr_task_start_up(spp_wr_task_cb_t p_cback, void *param)
 {
-    xTaskCreate(p_cback, "write_read", 2048, (void *)fd, 5, NULL);
+    // Created on every connection so the stack is always taken from heap
+    return mem_task_create(p_cback, "write_read", CONFIG_DATA_TASK_STACK_SIZE, param, 5, NULL, NULL) != NULL;
 }
 
 void spp_wr_task_shut_down(void)
 {
+    mem_task_exit();
     vTaskDelete(NULL);
 }
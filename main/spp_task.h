@@ -54,9 +54,10 @@ void spp_task_task_shut_down(void);
 /**
  * @brief     handler for write and read
  */
-typedef void (* spp_wr_task_cb_t) (void *fd);
+typedef void (* spp_wr_task_cb_t) (void *param);
 
-void spp_wr_task_start_up(spp_wr_task_cb_t p_cback, int fd);
+// Returns false if the task could not be created
+bool spp_wr_task_start_up(spp_wr_task_cb_t p_cback, void *param);
 
 void spp_wr_task_shut_down(void);
 
@@ -22,6 +22,7 @@
 #include "nvs_flash.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/uart.h"
 #include "esp_log.h"
 #include "esp_bt.h"
@@ -39,6 +40,14 @@
 #include "sys/unistd.h"
 
 #include "ble_server.h"
+#include "uart_store.h"
+#include "boot_time.h"
+#include "capture.h"
+#include "bench.h"
+#include "hot_log.h"
+#include "mem_report.h"
+#include "ble_shaper.h"
+#include "reconnect.h"
 
 #define SPP_TAG "SPP_ACCEPTOR"
 #define SPP_SERVER_NAME "SPP_SERVER"
@@ -87,20 +96,136 @@ static const esp_spp_sec_t sec_mask = ESP_SPP_SEC_AUTHENTICATE;
 static const esp_spp_role_t role_slave = ESP_SPP_ROLE_SLAVE;
 
 #define SPP_BUFF_SZ 100
-static uint8_t spp_buff[SPP_BUFF_SZ];
+
+// The max number of chunks transferred in one direction before giving other channels a chance to run
+#define SPP_BURST_CHUNKS 8
 
 static bool alt_settings;
 
 #define BT_UART UART_NUM_1
 
-static int uart_to_bt(int bt_fd, TickType_t ticks_to_wait)
+#ifdef CONFIG_SPP_CHANNEL2_EN
+#define BT_CHANNELS 2
+#define BT_UART2 CONFIG_SPP_CHANNEL2_UART_NUM
+#if BT_UART2 == BT_UART
+#error "The second channel UART is used by the first channel"
+#endif
+#if BT_UART2 == 2 && defined(BLE_ADAPTER_EN)
+#error "UART2 is used by BLE adapter. Set bluetooth controller mode to BR/EDR Only."
+#endif
+#if BT_UART2 == 0 && !defined(CONFIG_CONSOLE_UART_NONE) && CONFIG_CONSOLE_UART_NUM == 0
+#error "UART0 is used by console. Set console output to None."
+#endif
+#ifdef CONFIG_SPP_CHANNEL2_CTS_EN
+#define BT_UART2_FLOWCTRL  UART_HW_FLOWCTRL_CTS_RTS
+#define BT_UART2_CTS_GPIO  CONFIG_SPP_CHANNEL2_CTS_GPIO
+#else
+#define BT_UART2_FLOWCTRL  UART_HW_FLOWCTRL_RTS
+#define BT_UART2_CTS_GPIO  UART_PIN_NO_CHANGE
+#endif
+#else
+#define BT_CHANNELS 1
+#endif
+
+#ifdef UART_STORE_EN
+#define BT_UART_STORE_SZ (1024 * CONFIG_UART_STORE_BUFF_SIZE)
+#endif
+
+// UART <-> SPP server channel pair configuration
+struct bt_channel_cfg {
+    uart_port_t           uart;
+    int                   tx_gpio;
+    int                   rx_gpio;
+    int                   rts_gpio;
+    int                   cts_gpio;
+    int                   bitrate;
+    uart_hw_flowcontrol_t flow_ctrl;
+    int                   rx_buf_sz;
+    int                   tx_buf_sz;
+    const char*           srv_name;
+};
+
+static const struct bt_channel_cfg bt_channel_cfgs[BT_CHANNELS] = {
+    {
+        .uart      = BT_UART,
+        .tx_gpio   = BT_UART_TX_GPIO,
+        .rx_gpio   = BT_UART_RX_GPIO,
+        .rts_gpio  = BT_UART_RTS_GPIO,
+        .cts_gpio  = BT_UART_CTS_GPIO,
+        .bitrate   = BT_UART_BITRATE,
+        .flow_ctrl = BT_UART_FLOWCTRL,
+        .rx_buf_sz = BT_UART_RX_BUF_SZ,
+        .tx_buf_sz = BT_UART_TX_BUF_SZ,
+        .srv_name  = SPP_SERVER_NAME,
+    },
+#ifdef CONFIG_SPP_CHANNEL2_EN
+    {
+        .uart      = BT_UART2,
+        .tx_gpio   = CONFIG_SPP_CHANNEL2_TX_GPIO,
+        .rx_gpio   = CONFIG_SPP_CHANNEL2_RX_GPIO,
+        .rts_gpio  = CONFIG_SPP_CHANNEL2_RTS_GPIO,
+        .cts_gpio  = BT_UART2_CTS_GPIO,
+        .bitrate   = CONFIG_SPP_CHANNEL2_BITRATE,
+        .flow_ctrl = BT_UART2_FLOWCTRL,
+        .rx_buf_sz = 1024 * CONFIG_SPP_CHANNEL2_RX_BUFF_SIZE,
+        .tx_buf_sz = 1024 * CONFIG_SPP_CHANNEL2_TX_BUFF_SIZE,
+        .srv_name  = SPP_SERVER_NAME "2",
+    },
+#endif
+};
+
+// UART <-> SPP server channel pair state
+struct bt_channel {
+    const struct bt_channel_cfg* cfg;
+    uint8_t       idx;
+    int           fd;          // connected client socket
+    uint32_t      srv_handle;  // listening server handle
+    bool          connected;
+    bool          opened;      // the connection is open till its session ends
+    bool          xfer_started; // data was transferred since connection
+#ifdef FAST_RECONNECT_EN
+    TaskHandle_t  task;        // data transfer task waiting for connection
+#endif
+#ifdef BENCH_EN
+    bool          rx_started;  // data was received from client since connection
+    int           bench_req;   // the size of the bench mode request in buffer
+    bool          bench_active; // bench session is running without the channel lock held
+    bench_state_t bench;
+#endif
+    uint8_t       buff[SPP_BUFF_SZ];
+#ifdef UART_STORE_EN
+    uart_store_t* store;
+#endif
+#ifdef CONFIG_ALT_HOT_SWITCH
+    SemaphoreHandle_t lock;    // held while accessing UART to exclude reconfiguration
+#ifdef STATIC_ALLOC_EN
+    StaticSemaphore_t lock_buff;
+#endif
+#endif
+};
+
+static struct bt_channel bt_channels[BT_CHANNELS];
+static int bt_channels_started;
+static int bt_channels_connected;
+static portMUX_TYPE bt_channels_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#ifdef CONFIG_ALT_HOT_SWITCH
+static inline void bt_channel_lock(struct bt_channel* ch)
+{
+    xSemaphoreTake(ch->lock, portMAX_DELAY);
+}
+
+static inline void bt_channel_unlock(struct bt_channel* ch)
+{
+    xSemaphoreGive(ch->lock);
+}
+#else
+static inline void bt_channel_lock(struct bt_channel* ch) {}
+static inline void bt_channel_unlock(struct bt_channel* ch) {}
+#endif
+
+static int bt_write(int bt_fd, const uint8_t* ptr, int size)
 {
-    int size = uart_read_bytes(BT_UART, spp_buff, SPP_BUFF_SZ, ticks_to_wait);
-    if (size <= 0) {
-        return 0;
-    }
-    ESP_LOGD(SPP_TAG, "UART -> %d bytes", size);
-    uint8_t* ptr = spp_buff;
     int remain = size;
     while (remain > 0)
     {
@@ -112,53 +237,212 @@ static int uart_to_bt(int bt_fd, TickType_t ticks_to_wait)
             vTaskDelay(1);
             continue;
         }
-        ESP_LOGD(SPP_TAG, "BT <- %d bytes", res);
+        HOT_LOGD(SPP_TAG, "BT <- %d bytes", res);
         remain -= res;
         ptr  += res;
     }
     return size;
 }
 
-static void spp_read_handle(void * param)
+static inline void bt_xfer_started(struct bt_channel* ch)
+{
+    if (!ch->xfer_started) {
+        ch->xfer_started = true;
+        reconnect_first_byte(ch->idx);
+    }
+}
+
+static int uart_to_bt(struct bt_channel* ch, TickType_t ticks_to_wait)
 {
-    int fd = (int)param;
+    int size = uart_read_bytes(ch->cfg->uart, ch->buff, SPP_BUFF_SZ, ticks_to_wait);
+    if (size <= 0) {
+        return 0;
+    }
+    HOT_LOGD(SPP_TAG, "UART%d -> %d bytes", ch->cfg->uart, size);
+    capture_record(CAPTURE_UART_TO_BT, ch->idx, ch->buff, size);
+    ble_shaper_spp_traffic(size);
+    int const res = bt_write(ch->fd, ch->buff, size);
+    if (res > 0)
+        bt_xfer_started(ch);
+    return res;
+}
+
+#ifdef UART_STORE_EN
+// Deliver data stored while disconnected
+static int uart_store_to_bt(struct bt_channel* ch)
+{
+    struct uart_store_stats st;
+    const uint8_t* data;
+    size_t size;
+    uart_store_stop(ch->store);
+    while ((size = uart_store_peek(ch->store, &data)) > 0) {
+        capture_record(CAPTURE_UART_TO_BT, ch->idx, data, size);
+        ble_shaper_spp_traffic(size);
+        if (bt_write(ch->fd, data, size) < 0)
+            return -1;
+        bt_xfer_started(ch);
+        uart_store_consume(ch->store, size);
+    }
+    uart_store_get_stats(ch->store, &st);
+    ESP_LOGI(SPP_TAG, "UART%d stored %u, forwarded %u, dropped %u bytes, max used %u",
+        ch->cfg->uart, st.stored, st.forwarded, st.dropped, st.max_used);
+    return 0;
+}
+#endif
 
-    ESP_LOGI(SPP_TAG, "BT connected, %u bytes free", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
-    gpio_set_level(BT_CONNECTED_GPIO, BT_LED_CONNECTED);
-    uart_flush(BT_UART);
+static void bt_set_connected(struct bt_channel* ch, bool connected)
+{
+    portENTER_CRITICAL(&bt_channels_lock);
+    ch->connected = connected;
+    if (!connected)
+        ch->opened = false;
+    bt_channels_connected += connected ? 1 : -1;
+    int const cnt = bt_channels_connected;
+    portEXIT_CRITICAL(&bt_channels_lock);
+    if (!connected)
+        reconnect_closed(ch->idx);
+    ble_shaper_spp_connected(cnt);
+    gpio_set_level(BT_CONNECTED_GPIO, cnt ? BT_LED_CONNECTED : BT_LED_DISCONNECTED);
+}
+
+// Transfer data in both directions. Returns negative value if disconnected,
+// positive value if bench mode is requested by client.
+static int bt_transfer(struct bt_channel* ch, TickType_t* ticks_to_wait)
+{
+    // Send available data from UART to BT first
+    for (int i = 0; i < SPP_BURST_CHUNKS; ++i) {
+        int tx_size = uart_to_bt(ch, *ticks_to_wait);
+        if (tx_size < 0)
+            return -1;
+        if (!tx_size)
+            break;
+        *ticks_to_wait = 0;
+    }
+    // Try receive data from BT
+    int const size = read(ch->fd, ch->buff, SPP_BUFF_SZ);
+    if (size < 0) {
+        return -1;
+    }
+    if (size > 0) {
+#ifdef BENCH_EN
+        if (!ch->rx_started) {
+            ch->rx_started = true;
+            if (bench_requested(ch->buff, size)) {
+                ch->bench_req = size;
+                return 1;
+            }
+        }
+#endif
+        bt_xfer_started(ch);
+        HOT_LOGD(SPP_TAG, "BT -> %d bytes -> UART%d", size, ch->cfg->uart);
+        capture_record(CAPTURE_BT_TO_UART, ch->idx, ch->buff, size);
+        ble_shaper_spp_traffic(size);
+        uart_write_bytes(ch->cfg->uart, (const char *)ch->buff, size);
+        *ticks_to_wait = 0;
+    } else
+        *ticks_to_wait = 1;
+    return 0;
+}
+
+// Serve the client connection till disconnected
+static void bt_session(struct bt_channel* ch)
+{
+    uart_port_t const uart = ch->cfg->uart;
+    int res = 0;
+
+    ESP_LOGI(SPP_TAG, "BT connected to UART%d, %u bytes free", uart, heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    bt_channel_lock(ch);
+    ch->xfer_started = false;
+    bt_set_connected(ch, true);
+#ifdef UART_STORE_EN
+    res = uart_store_to_bt(ch);
+#else
+    uart_flush(uart);
+#endif
+    bt_channel_unlock(ch);
 
     TickType_t ticks_to_wait = 1;
+#ifdef BENCH_EN
+    ch->rx_started = false;
+    ch->bench_req = bench_strapped() ? 0 : -1;
+#endif
 
-    for (;;)
+    while (res >= 0)
     {
-        // Send available data from UART to BT first
-        for (;;) {
-            int tx_size = uart_to_bt(fd, ticks_to_wait);
-            if (tx_size < 0)
-                goto disconnected;
-            if (!tx_size)
-                break;
-            ticks_to_wait = 0;
-        }
-        // Try receive data from BT
-        int const size = read(fd, spp_buff, SPP_BUFF_SZ);
-        if (size < 0) {
-            goto disconnected;
+        bt_channel_lock(ch);
+#ifdef BENCH_EN
+        if (ch->bench_req >= 0) {
+            // The session runs till disconnect so the lock is not held, the UART settings
+            // are not switched meanwhile
+            ch->bench_active = true;
+            bt_channel_unlock(ch);
+            bench_run(&ch->bench, ch->fd, uart, ch->buff, ch->bench_req);
+            bt_channel_lock(ch);
+            ch->bench_active = false;
+            bt_channel_unlock(ch);
+            break;
         }
-        if (size > 0) {
-            ESP_LOGD(SPP_TAG, "BT -> %d bytes -> UART", size);
-            uart_write_bytes(BT_UART, (const char *)spp_buff, size);
-            ticks_to_wait = 0;
-        } else
-            ticks_to_wait = 1;
+#endif
+        res = bt_transfer(ch, &ticks_to_wait);
+        bt_channel_unlock(ch);
+#if BT_CHANNELS > 1
+        // Let other channels of the same priority run while we are busy
+        if (!ticks_to_wait)
+            taskYIELD();
+#endif
     }
 
-disconnected:
-    ESP_LOGI(SPP_TAG, "BT disconnected");
-    gpio_set_level(BT_CONNECTED_GPIO, BT_LED_DISCONNECTED);
+    ESP_LOGI(SPP_TAG, "BT disconnected from UART%d", uart);
+    bt_channel_lock(ch);
+    bt_set_connected(ch, false);
+#ifdef UART_STORE_EN
+    uart_store_start(ch->store);
+#endif
+    bt_channel_unlock(ch);
+    ble_shaper_report();
+    mem_report();
+}
+
+#ifdef FAST_RECONNECT_EN
+
+MEM_TASK_STORAGE(bt_data0, CONFIG_DATA_TASK_STACK_SIZE);
+#if BT_CHANNELS > 1
+MEM_TASK_STORAGE(bt_data1, CONFIG_DATA_TASK_STACK_SIZE);
+#endif
+
+// The data transfer task is created on startup and waits for connection so the transfer
+// starts right after the connection is open
+static void bt_data_task(void* param)
+{
+    struct bt_channel* const ch = param;
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bt_session(ch);
+    }
+}
+
+// The task handle is left NULL on failure so the channel connections are rejected
+static void bt_data_task_start(struct bt_channel* ch)
+{
+#if BT_CHANNELS > 1
+    if (ch->idx) {
+        ch->task = MEM_TASK_CREATE(bt_data1, bt_data_task, "btData1", ch, 5);
+        return;
+    }
+#endif
+    ch->task = MEM_TASK_CREATE(bt_data0, bt_data_task, "btData0", ch, 5);
+}
+
+#else
+
+static void spp_read_handle(void * param)
+{
+    bt_session(param);
     spp_wr_task_shut_down();
 }
 
+#endif
+
 static inline char hex_digit(uint8_t v)
 {
     return v < 10 ? '0' + v : 'A' + v - 10;
@@ -200,6 +484,19 @@ const char* get_device_name(void)
     return alt_settings ? bt_get_alt_dev_name() : bt_get_dev_name();
 }
 
+static struct bt_channel* bt_channel_by_srv_handle(uint32_t handle)
+{
+    for (int i = 0; i < BT_CHANNELS; ++i) {
+        if (bt_channels[i].srv_handle == handle)
+            return &bt_channels[i];
+    }
+#if BT_CHANNELS == 1
+    return &bt_channels[0];
+#else
+    return NULL;
+#endif
+}
+
 static void esp_spp_cb(uint16_t e, void *p)
 {
     esp_spp_cb_event_t event = e;
@@ -209,8 +506,9 @@ static void esp_spp_cb(uint16_t e, void *p)
     case ESP_SPP_INIT_EVT:
         ESP_LOGI(SPP_TAG, "ESP_SPP_INIT_EVT");
         ESP_ERROR_CHECK(esp_bt_dev_set_device_name(get_device_name()));
-        esp_bt_gap_set_scan_mode(ESP_BT_SCAN_MODE_CONNECTABLE_DISCOVERABLE);
-        esp_spp_start_srv(sec_mask,role_slave, 0, SPP_SERVER_NAME);
+        esp_bt_gap_set_scan_mode(reconnect_scan_mode());
+        // Servers are started one by one so the START_EVT handle may be matched to the channel
+        esp_spp_start_srv(sec_mask,role_slave, 0, bt_channels[0].cfg->srv_name);
         break;
     case ESP_SPP_DISCOVERY_COMP_EVT:
         ESP_LOGI(SPP_TAG, "ESP_SPP_DISCOVERY_COMP_EVT");
@@ -223,14 +521,61 @@ static void esp_spp_cb(uint16_t e, void *p)
         break;
     case ESP_SPP_START_EVT:
         ESP_LOGI(SPP_TAG, "ESP_SPP_START_EVT");
+        if (bt_channels_started >= BT_CHANNELS)
+            break;
+        bt_channels[bt_channels_started++].srv_handle = param->start.handle;
+        if (bt_channels_started < BT_CHANNELS) {
+            esp_spp_start_srv(sec_mask,role_slave, 0, bt_channels[bt_channels_started].cfg->srv_name);
+            break;
+        }
+        boot_stage("connectable");
+        boot_report();
+        mem_report();
         break;
     case ESP_SPP_CL_INIT_EVT:
         ESP_LOGI(SPP_TAG, "ESP_SPP_CL_INIT_EVT");
         break;
-    case ESP_SPP_SRV_OPEN_EVT:
+    case ESP_SPP_SRV_OPEN_EVT: {
         ESP_LOGI(SPP_TAG, "ESP_SPP_SRV_OPEN_EVT");
-        spp_wr_task_start_up(spp_read_handle, param->srv_open.fd);
+        ble_shaper_spp_setup();
+        struct bt_channel* ch = bt_channel_by_srv_handle(param->srv_open.handle);
+        if (!ch) {
+            ESP_LOGE(SPP_TAG, "no channel for server handle %u", param->srv_open.handle);
+            close(param->srv_open.fd);
+            break;
+        }
+        // The connected server handle is replaced by the new listening one if the server keeps listening
+        if (param->srv_open.new_listen_handle)
+            ch->srv_handle = param->srv_open.new_listen_handle;
+        // The channel serves one client at a time, the session may still be running if its
+        // disconnection was not handled yet
+        portENTER_CRITICAL(&bt_channels_lock);
+        bool const busy = ch->opened;
+        ch->opened = true;
+        portEXIT_CRITICAL(&bt_channels_lock);
+        if (busy) {
+            ESP_LOGW(SPP_TAG, "channel %d is busy, connection rejected", ch->idx);
+            close(param->srv_open.fd);
+            break;
+        }
+        ch->fd = param->srv_open.fd;
+        reconnect_open(ch->idx);
+#ifdef FAST_RECONNECT_EN
+        if (ch->task) {
+            xTaskNotifyGive(ch->task);
+        } else {
+            ESP_LOGE(SPP_TAG, "channel %d has no data task, connection rejected", ch->idx);
+            close(ch->fd);
+            ch->opened = false;
+        }
+#else
+        if (!spp_wr_task_start_up(spp_read_handle, ch)) {
+            close(ch->fd);
+            ch->opened = false;
+        }
+#endif
         break;
+    }
     default:
         break;
     }
@@ -243,6 +588,20 @@ static void esp_spp_stack_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param
 
 void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
 {
+    switch (event) {
+    case ESP_BT_GAP_AUTH_CMPL_EVT:
+    case ESP_BT_GAP_PIN_REQ_EVT:
+    case ESP_BT_GAP_CFM_REQ_EVT:
+    case ESP_BT_GAP_KEY_NOTIF_EVT:
+    case ESP_BT_GAP_KEY_REQ_EVT:
+        // Pairing is a part of SPP connection setup, let it complete without BLE interference.
+        // The other GAP events (discovery, mode changes) are not related to the connection setup.
+        ble_shaper_spp_setup();
+        break;
+    default:
+        break;
+    }
+
     switch (event) {
     case ESP_BT_GAP_AUTH_CMPL_EVT:{
         if (param->auth_cmpl.stat == ESP_BT_STATUS_SUCCESS) {
@@ -287,8 +646,169 @@ void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
     return;
 }
 
+static esp_err_t nvs_init(void)
+{
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    return ret;
+}
+
+static void bt_uart_get_config(const struct bt_channel* ch, uart_config_t* uart_config)
+{
+    const struct bt_channel_cfg* const cfg = ch->cfg;
+    // Alternative settings apply to the first channel only
+    bool const alt = alt_settings && !ch->idx;
+    *uart_config = (uart_config_t){
+        .baud_rate = alt ? BT_UART_BITRATE_ALT : cfg->bitrate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity    = alt ? BT_UART_PARITY_ALT : UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = alt ? BT_UART_FLOWCTRL_ALT : cfg->flow_ctrl,
+        .rx_flow_ctrl_thresh = UART_FIFO_LEN - 4
+    };
+}
+
+static bool bt_uart_init(struct bt_channel* ch)
+{
+    const struct bt_channel_cfg* const cfg = ch->cfg;
+    uart_config_t uart_config;
+    bt_uart_get_config(ch, &uart_config);
+
+    ESP_ERROR_CHECK(uart_param_config(cfg->uart, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(cfg->uart, cfg->tx_gpio, cfg->rx_gpio, cfg->rts_gpio, cfg->cts_gpio));
+    ESP_ERROR_CHECK(uart_driver_install(cfg->uart, cfg->rx_buf_sz, cfg->tx_buf_sz, 0, NULL, 0));
+    mem_account(false, cfg->rx_buf_sz + cfg->tx_buf_sz);
+#ifdef CONFIG_ALT_HOT_SWITCH
+#ifdef STATIC_ALLOC_EN
+    ch->lock = xSemaphoreCreateMutexStatic(&ch->lock_buff);
+#else
+    ch->lock = xSemaphoreCreateMutex();
+#endif
+#endif
+#ifdef UART_STORE_EN
+    ch->store = uart_store_create(cfg->uart, BT_UART_STORE_SZ);
+    if (!ch->store) {
+        ESP_LOGE(SPP_TAG, "%s store-and-forward buffer allocation failed", __func__);
+        return false;
+    }
+    uart_store_start(ch->store);
+#endif
+    return true;
+}
+
+static void alt_indicator_set(bool alt)
+{
+    if (alt) {
+        gpio_pad_select_gpio(BT_ALT_INDICATOR_GPIO);
+        gpio_set_level(BT_ALT_INDICATOR_GPIO, 1);
+        gpio_set_direction(BT_ALT_INDICATOR_GPIO, GPIO_MODE_OUTPUT);
+    } else {
+        // High impedance state
+        gpio_set_direction(BT_ALT_INDICATOR_GPIO, GPIO_MODE_INPUT);
+    }
+}
+
+#ifdef CONFIG_ALT_HOT_SWITCH
+
+#define ALT_POLL_MS      10
+#define ALT_DEBOUNCE_CNT ((CONFIG_ALT_DEBOUNCE_MS + ALT_POLL_MS - 1) / ALT_POLL_MS)
+#define ALT_DRAIN_TOUT   (1000 / portTICK_PERIOD_MS)
+
+// Switch the first channel UART between normal and alternative settings
+// without disturbing the bluetooth connection.
+// Returns false if the switch can't be done now
+static bool alt_switch(bool alt)
+{
+    struct bt_channel* const ch = &bt_channels[0];
+    uart_port_t const uart = ch->cfg->uart;
+    uart_config_t uart_config;
+
+    bt_channel_lock(ch);
+#ifdef BENCH_EN
+    if (ch->bench_active) {
+        bt_channel_unlock(ch);
+        return false;
+    }
+#endif
+    ESP_LOGI(SPP_TAG, "switching to %s settings", alt ? "alternative" : "normal");
+    if (ch->connected) {
+        // Deliver data received with old settings. The data may keep coming so only the data buffered
+        // by now is delivered, and the time is limited in case the BT link is slow.
+        size_t pending = 0;
+        uart_get_buffered_data_len(uart, &pending);
+        TickType_t const start = xTaskGetTickCount();
+        while (pending && xTaskGetTickCount() - start < ALT_DRAIN_TOUT) {
+            int const res = uart_to_bt(ch, 0);
+            if (res <= 0)
+                break;
+            pending -= (size_t)res < pending ? (size_t)res : pending;
+        }
+        if (pending)
+            ESP_LOGW(SPP_TAG, "UART%d receive drain incomplete, %u bytes left", uart, pending);
+    } else {
+#ifdef UART_STORE_EN
+        uart_store_stop(ch->store);
+#endif
+    }
+    if (uart_wait_tx_done(uart, ALT_DRAIN_TOUT) != ESP_OK)
+        ESP_LOGW(SPP_TAG, "UART%d transmit drain timeout", uart);
+
+    alt_settings = alt;
+    bt_uart_get_config(ch, &uart_config);
+    ESP_ERROR_CHECK(uart_param_config(uart, &uart_config));
+
+#ifdef UART_STORE_EN
+    if (!ch->connected)
+        uart_store_start(ch->store);
+#endif
+    bt_channel_unlock(ch);
+
+    alt_indicator_set(alt);
+#ifdef CONFIG_ALT_HOT_SWITCH_NAME
+    esp_bt_dev_set_device_name(get_device_name());
+#endif
+    return true;
+}
+
+MEM_TASK_STORAGE(alt_watch, 2048);
+
+static void alt_watch_task(void* param)
+{
+    bool alt = alt_settings;
+    bool deferred = false;
+    int cnt = 0;
+    for (;;) {
+        vTaskDelay(ALT_POLL_MS / portTICK_PERIOD_MS);
+        bool const level_alt = !gpio_get_level(BT_ALT_SWITCH_GPIO);
+        if (level_alt == alt) {
+            cnt = 0;
+            continue;
+        }
+        if (++cnt < ALT_DEBOUNCE_CNT)
+            continue;
+        cnt = 0;
+        if (!alt_switch(level_alt)) {
+            // Retried on the next debounce period
+            if (!deferred)
+                ESP_LOGW(SPP_TAG, "UART settings switch deferred till bench session ends");
+            deferred = true;
+            continue;
+        }
+        deferred = false;
+        alt = level_alt;
+    }
+}
+
+#endif
+
 void app_main()
 {
+    mem_report_init();
+    boot_stage("start");
+
     /* Configure GPIO mux */
     gpio_pad_select_gpio(BT_ALT_SWITCH_GPIO);
     gpio_set_direction(BT_ALT_SWITCH_GPIO, GPIO_MODE_INPUT);
@@ -300,31 +820,35 @@ void app_main()
 
     alt_settings = !gpio_get_level(BT_ALT_SWITCH_GPIO);
     if (alt_settings) {
-        gpio_pad_select_gpio(BT_ALT_INDICATOR_GPIO);
-        gpio_set_level(BT_ALT_INDICATOR_GPIO, 1);
-        gpio_set_direction(BT_ALT_INDICATOR_GPIO, GPIO_MODE_OUTPUT);
+        alt_indicator_set(true);
     }
+#ifdef BENCH_EN
+    bench_init();
+#endif
+    boot_stage("gpio");
 
-    /* Configure UART */
-    uart_config_t uart_config = {
-        .baud_rate = alt_settings ? BT_UART_BITRATE_ALT : BT_UART_BITRATE,
-        .data_bits = UART_DATA_8_BITS,
-        .parity    = alt_settings ? BT_UART_PARITY_ALT : UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = alt_settings ? BT_UART_FLOWCTRL_ALT : BT_UART_FLOWCTRL,
-        .rx_flow_ctrl_thresh = UART_FIFO_LEN - 4
-    };
-
-    ESP_ERROR_CHECK(uart_param_config(BT_UART, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(BT_UART, BT_UART_TX_GPIO, BT_UART_RX_GPIO, BT_UART_RTS_GPIO, BT_UART_CTS_GPIO));
-    ESP_ERROR_CHECK(uart_driver_install(BT_UART, BT_UART_RX_BUF_SZ, BT_UART_TX_BUF_SZ, 0, NULL, 0));
+    hot_log_init();
+    capture_init();
 
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
+    /* Configure UART */
+    for (int i = 0; i < BT_CHANNELS; ++i) {
+        struct bt_channel* const ch = &bt_channels[i];
+        ch->cfg = &bt_channel_cfgs[i];
+        ch->idx = i;
+        ch->fd = -1;
+        ch->srv_handle = 0xffffffff;
+        if (!bt_uart_init(ch)) {
+            return;
+        }
+#ifdef FAST_RECONNECT_EN
+        bt_data_task_start(ch);
+#endif
     }
+    boot_stage("uart");
+
+    esp_err_t ret = nvs_init();
     ESP_ERROR_CHECK( ret );
+    boot_stage("nvs");
 
 #ifndef BLE_ADAPTER_EN
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
@@ -335,6 +859,7 @@ void app_main()
         ESP_LOGE(SPP_TAG, "%s initialize controller failed", __func__);
         return;
     }
+    boot_stage("bt_ctrl_init");
 
 #ifndef BLE_ADAPTER_EN
 #define BT_MODE ESP_BT_MODE_CLASSIC_BT
@@ -346,6 +871,7 @@ void app_main()
         ESP_LOGE(SPP_TAG, "%s enable controller failed", __func__);
         return;
     }
+    boot_stage("bt_ctrl_enable");
 
     if (esp_bluedroid_init() != ESP_OK) {
         ESP_LOGE(SPP_TAG, "%s initialize bluedroid failed", __func__);
@@ -356,6 +882,7 @@ void app_main()
         ESP_LOGE(SPP_TAG, "%s enable bluedroid failed", __func__);
         return;
     }
+    boot_stage("bluedroid");
 
     if (esp_bt_gap_register_callback(esp_bt_gap_cb) != ESP_OK) {
         ESP_LOGE(SPP_TAG, "%s gap register failed: %s\n", __func__, esp_err_to_name(ret));
@@ -373,6 +900,7 @@ void app_main()
         ESP_LOGE(SPP_TAG, "%s spp init failed", __func__);
         return;
     }
+    boot_stage("spp_init");
 
     /* Set default parameters for Secure Simple Pairing */
     esp_bt_sp_param_t param_type = ESP_BT_SP_IOCAP_MODE;
@@ -387,8 +915,12 @@ void app_main()
     esp_bt_pin_code_t pin_code;
     esp_bt_gap_set_pin(pin_type, 0, pin_code);
 
+#ifdef CONFIG_ALT_HOT_SWITCH
+    MEM_TASK_CREATE(alt_watch, alt_watch_task, "altWatch", NULL, 3);
+#endif
+
 #ifdef BLE_ADAPTER_EN
     ble_server_init();
+    boot_stage("ble");
 #endif
 }
-
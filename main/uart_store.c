@@ -0,0 +1,173 @@
+#include "uart_store.h"
+
+#ifdef UART_STORE_EN
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "mem_report.h"
+
+#define STORE_TAG "UART_STORE"
+
+#define STORE_RUN  BIT0 // drain requested
+#define STORE_IDLE BIT1 // drain task is not reading UART
+
+#define STORE_CHUNK 128
+#define STORE_STACK_SZ 2048
+
+struct uart_store {
+    uart_port_t        uart;
+    uint8_t*           buff;
+    size_t             size;
+    size_t             head;  // write position
+    size_t             tail;  // read position
+    size_t             used;
+    EventGroupHandle_t ev;
+    struct uart_store_stats stats;
+#ifdef STATIC_ALLOC_EN
+    StaticEventGroup_t ev_buff;
+    StaticTask_t       task_tcb;
+    StackType_t        task_stack[STORE_STACK_SZ];
+    uint8_t            store_buff[UART_STORE_STATIC_SIZE];
+#endif
+};
+
+#ifdef STATIC_ALLOC_EN
+static struct uart_store stores[UART_STORE_MAX];
+static int stores_used;
+#endif
+
+static void store_push(uart_store_t* s, const uint8_t* data, size_t len)
+{
+#ifdef CONFIG_UART_STORE_DROP_OLDEST
+    if (len >= s->size) {
+        // The new data alone fills the whole buffer
+        s->stats.dropped += s->used + (len - s->size);
+        data += len - s->size;
+        len = s->size;
+        s->head = s->tail = s->used = 0;
+    } else if (len > s->size - s->used) {
+        size_t const drop = len - (s->size - s->used);
+        s->tail = (s->tail + drop) % s->size;
+        s->used -= drop;
+        s->stats.dropped += drop;
+    }
+#else
+    size_t const avail = s->size - s->used;
+    if (len > avail) {
+        s->stats.dropped += len - avail;
+        len = avail;
+    }
+#endif
+    s->stats.stored += len;
+    s->used += len;
+    if (s->used > s->stats.max_used)
+        s->stats.max_used = s->used;
+    while (len) {
+        size_t chunk = s->size - s->head;
+        if (chunk > len)
+            chunk = len;
+        memcpy(s->buff + s->head, data, chunk);
+        s->head = (s->head + chunk) % s->size;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+static void store_task(void* param)
+{
+    uart_store_t* const s = param;
+    uint8_t chunk[STORE_CHUNK];
+    for (;;) {
+        xEventGroupWaitBits(s->ev, STORE_RUN, pdFALSE, pdTRUE, portMAX_DELAY);
+        xEventGroupClearBits(s->ev, STORE_IDLE);
+        while (xEventGroupGetBits(s->ev) & STORE_RUN) {
+            int const size = uart_read_bytes(s->uart, chunk, sizeof(chunk), 1);
+            if (size > 0)
+                store_push(s, chunk, size);
+        }
+        xEventGroupSetBits(s->ev, STORE_IDLE);
+    }
+}
+
+#ifdef STATIC_ALLOC_EN
+
+uart_store_t* uart_store_create(uart_port_t uart, size_t size)
+{
+    if (stores_used >= UART_STORE_MAX || size > UART_STORE_STATIC_SIZE) {
+        ESP_LOGE(STORE_TAG, "%s no static store for UART%d", __func__, uart);
+        return NULL;
+    }
+    uart_store_t* const s = &stores[stores_used++];
+    mem_account(true, sizeof(*s) - sizeof(s->task_stack) - sizeof(s->task_tcb));
+    s->buff = s->store_buff;
+    s->uart = uart;
+    s->size = size;
+    s->ev = xEventGroupCreateStatic(&s->ev_buff);
+    xEventGroupSetBits(s->ev, STORE_IDLE);
+    mem_task_create(store_task, "uStore", sizeof(s->task_stack), s, 5, s->task_stack, &s->task_tcb);
+    return s;
+}
+
+#else
+
+uart_store_t* uart_store_create(uart_port_t uart, size_t size)
+{
+    uart_store_t* const s = calloc(1, sizeof(*s));
+    if (!s) {
+        ESP_LOGE(STORE_TAG, "%s malloc failed", __func__);
+        return NULL;
+    }
+    s->buff = mem_alloc(size);
+    if (!s->buff) {
+        ESP_LOGE(STORE_TAG, "%s buffer malloc failed", __func__);
+        free(s);
+        return NULL;
+    }
+    mem_account(false, sizeof(*s) + sizeof(StaticEventGroup_t));
+    s->uart = uart;
+    s->size = size;
+    s->ev = xEventGroupCreate();
+    xEventGroupSetBits(s->ev, STORE_IDLE);
+    mem_task_create(store_task, "uStore", STORE_STACK_SZ, s, 5, NULL, NULL);
+    return s;
+}
+
+#endif
+
+void uart_store_start(uart_store_t* s)
+{
+    xEventGroupSetBits(s->ev, STORE_RUN);
+}
+
+void uart_store_stop(uart_store_t* s)
+{
+    xEventGroupClearBits(s->ev, STORE_RUN);
+    xEventGroupWaitBits(s->ev, STORE_IDLE, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+size_t uart_store_peek(uart_store_t* s, const uint8_t** data)
+{
+    size_t size = s->size - s->tail;
+    if (size > s->used)
+        size = s->used;
+    *data = s->buff + s->tail;
+    return size;
+}
+
+void uart_store_consume(uart_store_t* s, size_t size)
+{
+    s->tail = (s->tail + size) % s->size;
+    s->used -= size;
+    s->stats.forwarded += size;
+}
+
+void uart_store_get_stats(uart_store_t* s, struct uart_store_stats* stats)
+{
+    *stats = s->stats;
+}
+
+#endif
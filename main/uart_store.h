@@ -0,0 +1,59 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#ifdef CONFIG_UART_STORE_FORWARD
+#define UART_STORE_EN
+#endif
+
+#ifdef UART_STORE_EN
+
+#include <stdint.h>
+#include <stddef.h>
+#include "driver/uart.h"
+
+/*
+ * Store-and-forward buffer. While no BT client is connected the drain task keeps reading
+ * UART into the bounded ring buffer so the data is not lost during short link dropouts.
+ * The stored data is delivered to the next client before anything else.
+ */
+
+typedef struct uart_store uart_store_t;
+
+struct uart_store_stats {
+    uint32_t stored;     // bytes put into the buffer
+    uint32_t dropped;    // bytes lost due to buffer overflow
+    uint32_t forwarded;  // bytes delivered to the BT client
+    uint32_t max_used;   // buffer usage high water mark
+};
+
+// The max number of stores, one per bluetooth channel
+#ifdef CONFIG_SPP_CHANNEL2_EN
+#define UART_STORE_MAX 2
+#else
+#define UART_STORE_MAX 1
+#endif
+
+// The buffer size used with static allocation
+#define UART_STORE_STATIC_SIZE (1024 * CONFIG_UART_STORE_BUFF_SIZE)
+
+// Allocate buffer of the given size and create drain task. The drain is initially stopped.
+// With static allocation enabled the size may not exceed UART_STORE_STATIC_SIZE.
+uart_store_t* uart_store_create(uart_port_t uart, size_t size);
+
+// Start draining UART into the buffer. Called on disconnect.
+void uart_store_start(uart_store_t* s);
+
+// Stop draining. Returns after the drain task is no longer reading UART.
+void uart_store_stop(uart_store_t* s);
+
+// Get contiguous block of stored data. Returns its size or 0 if the buffer is empty.
+// Must be called with drain stopped.
+size_t uart_store_peek(uart_store_t* s, const uint8_t** data);
+
+// Release size bytes returned by uart_store_peek.
+void uart_store_consume(uart_store_t* s, size_t size);
+
+void uart_store_get_stats(uart_store_t* s, struct uart_store_stats* stats);
+
+#endif
@@ -0,0 +1,162 @@
+"""
+Run self benchmark on the bridge built with bench mode enabled.
+
+Usage: bt_bench.py device_name [--strapped] [--bytes N] [test ...]
+
+The test size is 200000 bytes by default.
+The tests are gen, check, uart, ble and echo or loop (default is gen check uart echo).
+The echo and loop tests are run by the device till disconnect so only one of them
+may be given and it should be the last one. Results are printed in the same format
+as device reports them:
+BENCH test=<name> bytes=<count> ms=<time> kbps=<rate> errors=<count>
+The check, uart and ble results are measured on the device side. The gen result is measured
+on the host side from the command sent till the last byte received since the device side figure
+only tells how fast the data is accepted by the bluetooth stack buffers. The device figure is
+printed as device_kbps. The echo and loop test results are measured on the host side.
+The time the device report is waited for depends on the test size (see min_rate).
+"""
+
+from __future__ import print_function
+
+import sys
+import time
+import bluetooth
+
+bench_cmd = b'+++BENCH\n'
+idle_delay = .001
+tout = 10.
+# The minimum expected test rate (bytes/sec) the report timeout is based on
+min_rate = {'gen': 10000, 'check': 10000, 'uart': 10000, 'ble': 1000}
+
+def report_tout(test, size):
+	return tout + float(size) / min_rate[test]
+
+def pattern(off, size):
+	return bytearray((i ^ (i >> 8) ^ (i >> 16)) & 0xff for i in range(off, off + size))
+
+def find_address(dev_name):
+	dev_list = bluetooth.discover_devices(lookup_names = True)
+	for (addr, name) in dev_list:
+		if name == dev_name:
+			return addr
+	return None
+
+def recv_some(sock, size, tout=tout):
+	deadline = time.time() + tout
+	while True:
+		try:
+			data = sock.recv(size)
+		except bluetooth.BluetoothError:
+			data = None
+		if data:
+			return bytearray(data)
+		if time.time() > deadline:
+			raise RuntimeError('receive timeout')
+		time.sleep(idle_delay)
+
+def recv_line(sock, pending, tout=tout):
+	deadline = time.time() + tout
+	while b'\n' not in pending:
+		pending += recv_some(sock, 256, max(deadline - time.time(), idle_delay))
+	i = pending.index(b'\n')
+	return bytes(pending[:i]).decode(), pending[i+1:]
+
+def send_all(sock, data):
+	data = bytes(data)
+	while data:
+		try:
+			n = sock.send(data)
+		except bluetooth.BluetoothError:
+			n = 0
+		if not n:
+			time.sleep(idle_delay)
+			continue
+		data = data[n:]
+
+def report(test, bytes, sec, errors):
+	return 'BENCH test=%s bytes=%u ms=%u kbps=%u errors=%u' % (test, bytes, int(sec * 1000), int(bytes * 8 / sec / 1000) if sec else 0, errors)
+
+def run_gen(sock, size, pending):
+	send_all(sock, b'gen %u\n' % size)
+	start = time.time()
+	recvd, errors = 0, 0
+	while recvd < size:
+		if not pending:
+			pending = recv_some(sock, 4096)
+		n = min(len(pending), size - recvd)
+		ref = pattern(recvd, n)
+		errors += sum(1 for a, b in zip(pending[:n], ref) if a != b)
+		recvd += n
+		pending = pending[n:]
+	sec = time.time() - start
+	line, pending = recv_line(sock, pending)
+	fields = dict(f.split('=', 1) for f in line.split()[1:] if '=' in f)
+	print(report('gen', recvd, sec, errors) + ' device_kbps=%s' % fields.get('kbps', '?'))
+	return pending
+
+def run_check(sock, size, pending):
+	send_all(sock, b'check %u\n' % size)
+	for off in range(0, size, 4096):
+		send_all(sock, pattern(off, min(4096, size - off)))
+	line, pending = recv_line(sock, pending, report_tout('check', size))
+	print(line)
+	return pending
+
+def run_cmd(sock, test, size, pending):
+	send_all(sock, b'%s %u\n' % (test.encode(), size))
+	line, pending = recv_line(sock, pending, report_tout(test, size))
+	print(line)
+	return pending
+
+def run_echo(sock, test, size, pending):
+	send_all(sock, b'%s\n' % test.encode())
+	start = time.time()
+	sent, errors = 0, 0
+	while sent < size:
+		msg = pattern(sent, min(4096, size - sent))
+		send_all(sock, msg)
+		resp = bytearray()
+		while len(resp) < len(msg):
+			resp += recv_some(sock, len(msg) - len(resp))
+		errors += sum(1 for a, b in zip(msg, resp) if a != b)
+		sent += len(msg)
+	print(report(test, sent, time.time() - start, errors))
+
+def do_bench(addr, tests, size, strapped):
+	sock = bluetooth.BluetoothSocket(bluetooth.RFCOMM)
+	sock.connect((addr, 1))
+	sock.setblocking(False)
+	if not strapped:
+		send_all(sock, bench_cmd)
+	pending = bytearray()
+	for test in tests:
+		if test == 'gen':
+			pending = run_gen(sock, size, pending)
+		elif test == 'check':
+			pending = run_check(sock, size, pending)
+		elif test in ('uart', 'ble'):
+			pending = run_cmd(sock, test, size, pending)
+		elif test in ('echo', 'loop'):
+			run_echo(sock, test, size, pending)
+			break
+		else:
+			print('unknown test', test, file=sys.stderr)
+	sock.close()
+
+if __name__ == '__main__':
+	args = sys.argv[1:]
+	if not args:
+		print(__doc__, file=sys.stderr)
+		sys.exit(1)
+	dev_name, opts = args[0], args[1:]
+	strapped = '--strapped' in opts
+	size = 200000
+	if '--bytes' in opts:
+		size = int(opts[opts.index('--bytes') + 1])
+		del opts[opts.index('--bytes'):opts.index('--bytes') + 2]
+	tests = [t for t in opts if not t.startswith('--')] or ['gen', 'check', 'uart', 'echo']
+	addr = find_address(dev_name)
+	if not addr:
+		print('not found', file=sys.stderr)
+		sys.exit(-1)
+	do_bench(addr, tests, size, strapped)
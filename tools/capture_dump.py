@@ -0,0 +1,82 @@
+"""
+Decode bridge traffic capture read from the flash capture partition.
+
+First read the partition content (see partitions.csv for its location):
+  esptool.py --port /dev/ttyUSB0 read_flash 0x110000 0xF0000 capture.bin
+Then print it as text:
+  python capture_dump.py capture.bin
+or convert to pcap file (link type USER0, every packet starts with direction and channel bytes):
+  python capture_dump.py capture.bin --pcap capture.pcap
+Use --boot N to extract the data captured after the particular boot only.
+"""
+
+import sys
+import struct
+
+sector_size  = 4096
+sector_magic = 0x50434231
+sector_hdr   = struct.Struct('<III')  # magic, seq, boot
+rec_hdr      = struct.Struct('<IIHBB') # time_lo, time_hi, len, dir, chan
+rec_end      = 0xffff
+
+dir_names = ('UART->BT', 'BT->UART')
+
+pcap_linktype = 147 # LINKTYPE_USER0
+
+def read_sectors(data):
+	sectors = []
+	for off in range(0, len(data) - sector_size + 1, sector_size):
+		magic, seq, boot = sector_hdr.unpack_from(data, off)
+		if magic == sector_magic:
+			sectors.append((seq, boot, off))
+	if not sectors:
+		return []
+	# The log is circular. Find the oldest sector taking sequence wrap into account.
+	sectors.sort()
+	newest = sectors[-1][0]
+	sectors.sort(key=lambda s: (s[0] - newest - 1) & 0xffffffff)
+	return sectors
+
+def read_records(data, sectors):
+	for seq, boot, off in sectors:
+		pos, end = off + sector_hdr.size, off + sector_size
+		while pos + rec_hdr.size <= end:
+			time_lo, time_hi, size, dir, chan = rec_hdr.unpack_from(data, pos)
+			if size == rec_end or pos + rec_hdr.size + size > end:
+				break
+			body = data[pos + rec_hdr.size : pos + rec_hdr.size + size]
+			yield boot, (time_hi << 32) | time_lo, dir, chan, body
+			pos += (rec_hdr.size + size + 3) & ~3
+
+def printable(body):
+	return ''.join(chr(c) if 32 <= c < 127 else '.' for c in bytearray(body))
+
+def dump_text(records, out):
+	for boot, t, dir, chan, body in records:
+		name = dir_names[dir] if dir < len(dir_names) else 'dir%u' % dir
+		out.write('#%u %10.6f %s ch%u %4u | %s\n' % (boot, t / 1e6, name, chan, len(body), printable(body)))
+
+def dump_pcap(records, out):
+	out.write(struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535, pcap_linktype))
+	for boot, t, dir, chan, body in records:
+		pkt = struct.pack('BB', dir, chan) + bytes(body)
+		out.write(struct.pack('<IIII', t // 1000000, t % 1000000, len(pkt), len(pkt)))
+		out.write(pkt)
+
+if __name__ == '__main__':
+	args = sys.argv[1:]
+	if not args:
+		print(__doc__)
+		sys.exit(1)
+	with open(args[0], 'rb') as f:
+		data = f.read()
+	sectors = read_sectors(data)
+	if '--boot' in args:
+		boot = int(args[args.index('--boot') + 1])
+		sectors = [s for s in sectors if s[1] == boot]
+	records = read_records(data, sectors)
+	if '--pcap' in args:
+		with open(args[args.index('--pcap') + 1], 'wb') as out:
+			dump_pcap(records, out)
+	else:
+		dump_text(records, sys.stdout)
@@ -0,0 +1,324 @@
+'use strict';
+
+// Receiver worker. Decodes and validates chunks received from BLE characteristic
+// updates off the main thread. Chunks arrive as transferred ArrayBuffers. The results
+// are posted back in batches so the page gets at most one message per flush period.
+// If the device supports selective retransmission the worker puts the chunks in order,
+// requests the missing ones and acknowledges the received ones. The control characteristic
+// writes are posted to the page as ctl messages.
+
+const tag_base   = 'a'.charCodeAt(0);
+const tag_count  = 16;
+const msg_start  = '#'.charCodeAt(0);
+const msg_center = '_'.charCodeAt(0);
+
+const flush_period = 50;   // ms between result batches
+const rate_window  = 1000; // ms, throughput averaging window
+const msg_buff_max = 4096; // longer messages are considered corrupt
+
+const rtx_tag_base = 'A'.charCodeAt(0); // retransmitted chunks tag
+const rtx_no_ack   = '.'.charCodeAt(0);
+const rtx_window   = 8;    // max chunks not acknowledged by the device
+const ack_every    = 4;    // chunks delivered between acknowledgements
+const ack_delay    = 20;   // ms, acknowledge the rest of delivered chunks
+const nack_period  = 100;  // ms between repeated requests for missing chunks
+const gap_timeout  = 1000; // ms, give up missing chunks not received for that long
+
+let total_chunks = 0;
+let bad_chunks   = 0;
+let lost_chunks  = 0;
+let rcvd_chunks  = 0; // recovered by retransmission
+let total_msgs   = 0;
+let bad_msgs     = 0;
+let total_bytes  = 0;
+
+let last_tag  = null;
+let msg_buff  = new Uint8Array(msg_buff_max);
+let msg_len   = -1; // -1 means no message start seen yet
+
+let lat_sum   = 0;
+let lat_cnt   = 0;
+let lat_max   = 0;
+
+let rate_start = 0;
+let rate_bytes = 0;
+let rate       = 0;
+
+let reliable    = false;
+let next_seq    = 0;
+let pending     = new Array(tag_count).fill(null);
+let pending_cnt = 0;
+let delivered   = false;
+let unacked     = 0;
+let ack_timer   = null;
+let gap_since   = 0;
+let nack_time   = 0;
+
+let lines = [];
+let flush_timer = null;
+
+const decoder = new TextDecoder('latin1');
+
+function now()
+{
+    return performance.timeOrigin + performance.now();
+}
+
+function on_new_msg(len)
+{
+    total_msgs += 1;
+    if (len % 2) {
+        bad_msgs += 1;
+        return;
+    }
+    const half = len / 2;
+    if (msg_buff[half] !== msg_center) {
+        bad_msgs += 1;
+        return;
+    }
+    for (let i = 1; i < half; ++i) {
+        if (msg_buff[i] !== msg_buff[half + i]) {
+            bad_msgs += 1;
+            return;
+        }
+    }
+}
+
+function msg_append(data, start, end)
+{
+    if (msg_len < 0)
+        return;
+    const len = end - start;
+    if (msg_len + len > msg_buff_max) {
+        // Too long, drop it and count as corrupt once completed
+        msg_len = msg_buff_max + 1;
+        return;
+    }
+    msg_buff.set(data.subarray(start, end), msg_len);
+    msg_len += len;
+}
+
+function on_new_chunk(data)
+{
+    const tag = data[0] - tag_base;
+    if (last_tag !== null) {
+        const next_tag = (last_tag + 1) % tag_count;
+        if (tag !== next_tag) {
+            bad_chunks  += 1;
+            lost_chunks += (tag - next_tag + tag_count) % tag_count;
+            if (msg_len >= 0)
+                bad_msgs += 1;
+            msg_len = -1;
+        }
+    }
+    last_tag = tag;
+
+    let start = 1;
+    for (let i = 1; i < data.length; ++i) {
+        if (data[i] !== msg_start)
+            continue;
+        msg_append(data, start, i);
+        if (msg_len > msg_buff_max) {
+            total_msgs += 1;
+            bad_msgs += 1;
+        } else if (msg_len >= 0) {
+            on_new_msg(msg_len);
+        }
+        msg_len = 0;
+        start = i;
+    }
+    msg_append(data, start, data.length);
+
+    total_chunks += 1;
+    total_bytes  += data.length;
+    rate_bytes   += data.length;
+    lines.push(decoder.decode(data));
+}
+
+function send_ctl()
+{
+    const ctl = [delivered ? tag_base + (next_seq + tag_count - 1) % tag_count : rtx_no_ack];
+    if (pending_cnt) {
+        let last = 0;
+        for (let d = 1; d < rtx_window; ++d)
+            if (pending[(next_seq + d) % tag_count])
+                last = d;
+        for (let d = 0; d < last; ++d) {
+            const seq = (next_seq + d) % tag_count;
+            if (!pending[seq])
+                ctl.push(tag_base + seq);
+        }
+        nack_time = now();
+    }
+    if (ack_timer !== null) {
+        clearTimeout(ack_timer);
+        ack_timer = null;
+    }
+    unacked = 0;
+    postMessage({ctl: ctl});
+}
+
+function ack_soon()
+{
+    if (ack_timer === null)
+        ack_timer = setTimeout(() => { ack_timer = null; send_ctl(); }, ack_delay);
+}
+
+function deliver()
+{
+    while (pending[next_seq]) {
+        on_new_chunk(pending[next_seq]);
+        pending[next_seq] = null;
+        pending_cnt -= 1;
+        next_seq = (next_seq + 1) % tag_count;
+        delivered = true;
+        unacked += 1;
+    }
+}
+
+// Deliver the chunks received before the given sequence number skipping the missing ones,
+// they are counted as lost by on_new_chunk
+function skip_to(seq)
+{
+    while (next_seq !== seq) {
+        if (pending[next_seq]) {
+            on_new_chunk(pending[next_seq]);
+            pending[next_seq] = null;
+            pending_cnt -= 1;
+            delivered = true;
+            unacked += 1;
+        }
+        next_seq = (next_seq + 1) % tag_count;
+    }
+}
+
+// Selective retransmission mode, put the chunk in order
+function on_rtx_chunk(data)
+{
+    const resent = data[0] < tag_base;
+    const seq = (data[0] - (resent ? rtx_tag_base : tag_base)) % tag_count;
+    const d = (seq - next_seq + tag_count) % tag_count;
+    if (d >= rtx_window && !resent) {
+        // Only the resent chunk may be a stale duplicate. The new one outside of the window
+        // means the device gave up the chunks before it (the acknowledgements were lost).
+        skip_to(seq);
+    } else if (d >= rtx_window || pending[seq]) {
+        // Duplicate, the acknowledgement might be lost
+        ack_soon();
+        return;
+    }
+    if (resent)
+        rcvd_chunks += 1;
+    data[0] = tag_base + seq;
+    pending[seq] = data;
+    pending_cnt += 1;
+    deliver();
+    if (!pending_cnt) {
+        gap_since = 0;
+    } else if (!gap_since) {
+        // New gap, request the missing chunks at once
+        gap_since = now();
+        send_ctl();
+        return;
+    }
+    if (unacked >= ack_every)
+        send_ctl();
+    else if (unacked)
+        ack_soon();
+}
+
+function check_gap()
+{
+    if (!pending_cnt)
+        return;
+    const t = now();
+    if (t - gap_since >= gap_timeout) {
+        // Give up missing chunks, they are counted as lost
+        while (!pending[next_seq])
+            next_seq = (next_seq + 1) % tag_count;
+        deliver();
+        gap_since = pending_cnt ? t : 0;
+        send_ctl();
+    } else if (t - nack_time >= nack_period) {
+        send_ctl();
+    }
+}
+
+setInterval(check_gap, nack_period / 2);
+
+function update_rate(t)
+{
+    if (!rate_start) {
+        rate_start = t;
+        return;
+    }
+    const elapsed = t - rate_start;
+    if (elapsed >= rate_window) {
+        rate = rate_bytes * 1000 / elapsed;
+        rate_bytes = 0;
+        rate_start = t;
+    }
+}
+
+function flush()
+{
+    flush_timer = null;
+    const t = now();
+    update_rate(t);
+    postMessage({
+        lines: lines,
+        stats: {
+            total_chunks: total_chunks,
+            bad_chunks:   bad_chunks,
+            lost_chunks:  lost_chunks,
+            rcvd_chunks:  rcvd_chunks,
+            total_msgs:   total_msgs,
+            bad_msgs:     bad_msgs,
+            total_bytes:  total_bytes,
+            rate:         rate,
+            latency_avg:  lat_cnt ? lat_sum / lat_cnt : 0,
+            latency_max:  lat_max,
+        }
+    });
+    lines = [];
+    lat_sum = lat_cnt = lat_max = 0;
+}
+
+// Keep throughput figure up to date while no data is flowing
+setInterval(() => { if (flush_timer === null) flush(); }, rate_window);
+
+function reset(rtx)
+{
+    last_tag = null;
+    msg_len  = -1;
+    reliable = rtx;
+    next_seq = 0;
+    pending.fill(null);
+    pending_cnt = 0;
+    delivered = false;
+    unacked   = 0;
+    gap_since = 0;
+    if (ack_timer !== null) {
+        clearTimeout(ack_timer);
+        ack_timer = null;
+    }
+}
+
+onmessage = (event) => {
+    const req = event.data;
+    if (req.reset) {
+        reset(!!req.reliable);
+        return;
+    }
+    if (reliable)
+        on_rtx_chunk(new Uint8Array(req.buf));
+    else
+        on_new_chunk(new Uint8Array(req.buf));
+    const lat = now() - req.t;
+    lat_sum += lat;
+    lat_cnt += 1;
+    if (lat > lat_max)
+        lat_max = lat;
+    if (flush_timer === null)
+        flush_timer = setTimeout(flush, flush_period);
+};
@@ -2,26 +2,30 @@
 
 (() => {
 
-const bt_btn = document.getElementById('bt-btn');
-const rx_msg = document.getElementById('rx-msg');
-const chunks = document.getElementById('chunks');
-const msgs   = document.getElementById('msgs');
-const rx_msg_max = parseInt(rx_msg.getAttribute('rows'));
+const bt_btn  = document.getElementById('bt-btn');
+const rx_msg  = document.getElementById('rx-msg');
+const chunks  = document.getElementById('chunks');
+const msgs    = document.getElementById('msgs');
+const rate    = document.getElementById('rate');
+const loss    = document.getElementById('loss');
+const latency = document.getElementById('latency');
+const rx_msg_max = parseInt(rx_msg.getAttribute('data-rows'));
 
 const bt_svc_id  = 0xFFE0;
 const bt_char_id = 0xFFE1;
+const bt_ctl_id  = 0xFFE2; // selective retransmission control, missing in older firmware
+const bt_no_ack  = '.'.charCodeAt(0);
 
-let total_chunks = 0;
-let bad_chunks   = 0;
-let total_msgs   = 0;
-let bad_msgs     = 0;
+let bt_char   = null;
+let ctl_char  = null;
+let ctl_busy  = false;
+let ctl_next  = null;
+let rx_worker = null;
 
-let bt_char    = null;
-let rx_msgs    = [];
-let last_tag   = null;
-let msg_buff   = null;
-let msg_start  = '#';
-let msg_center = '_';
+// Updates pending till the next animation frame
+let pending_lines = [];
+let pending_stats = null;
+let frame_req     = false;
 
 function initPage()
 {
@@ -29,108 +33,141 @@ function initPage()
         document.body.innerHTML = '<div class="alert-page">The Bluetooth is not supported in this browser. Please try another one.</div>';
         return;
     }
+    rx_worker = new Worker('js/rx_worker.js');
+    rx_worker.onmessage = onWorkerResult;
     bt_btn.onclick = onConnect;
 }
 
-function showMessage(msg)
+function now()
 {
-    if (rx_msgs.length >= rx_msg_max)
-        rx_msgs.shift();
-    rx_msgs.push(msg);
-    console.log('rx:', msg);
-    rx_msg.textContent = rx_msgs.join('\n');
+    return performance.timeOrigin + performance.now();
 }
 
-function onDisconnection(event)
+function showLines(lines)
 {
-    const device = event.target;
-    console.log(device.name + ' bluetooth device disconnected');
-    rx_msg.disabled = true;
-    bt_char = null;
-    connectTo(device);
+    if (lines.length > rx_msg_max)
+        lines = lines.slice(lines.length - rx_msg_max);
+    const frag = document.createDocumentFragment();
+    for (const line of lines) {
+        const div = document.createElement('div');
+        div.textContent = line;
+        frag.appendChild(div);
+    }
+    rx_msg.appendChild(frag);
+    let excess = rx_msg.childElementCount - rx_msg_max;
+    while (excess-- > 0)
+        rx_msg.removeChild(rx_msg.firstChild);
 }
 
-function on_new_msg(msg)
+function showStats(st)
 {
-    total_msgs += 1;
-    if (msg.length % 2) {
-        console.log('invalid message length (' + msg.length + '): ' + msg)
-        bad_msgs += 1;
-        return;
-    }
-    if (msg.slice(msg.length/2, msg.length/2+1) != msg_center) {
-        console.log('invalid message : ' + msg)
-        bad_msgs += 1;
-        return;
+    chunks.textContent  = st.total_chunks + ' / ' + st.bad_chunks;
+    msgs.textContent    = st.total_msgs   + ' / ' + st.bad_msgs;
+    rate.textContent    = Math.round(st.rate) + ' B/s';
+    const sent = st.total_chunks + st.lost_chunks;
+    loss.textContent    = st.lost_chunks + ' (' + (sent ? (100 * st.lost_chunks / sent).toFixed(2) : '0.00') + '%)'
+                        + (ctl_char ? ', recovered ' + st.rcvd_chunks : '');
+    latency.textContent = st.latency_avg.toFixed(1) + ' / ' + st.latency_max.toFixed(1) + ' ms';
+}
+
+function onAnimationFrame()
+{
+    frame_req = false;
+    if (pending_lines.length) {
+        showLines(pending_lines);
+        pending_lines = [];
     }
-    if (msg.slice(1, msg.length/2) != msg.slice(msg.length/2 + 1)) {
-        console.log('corrupt message : ' + msg)
-        bad_msgs += 1;
-        return;
+    if (pending_stats) {
+        showStats(pending_stats);
+        pending_stats = null;
     }
 }
 
-function on_new_chunk(msg)
+// Only one GATT operation may be in progress. The control writes carry the whole
+// receiver state so the latest one supersedes the ones not written yet.
+function writeControl(value)
 {
-    const tag = msg.charCodeAt(0) - 'a'.charCodeAt(0);
-    let bad_chunk = false;
-    if (last_tag !== null) {
-        let next_tag = last_tag + 1;
-        if (next_tag > 15)
-            next_tag = 0;
-        if (tag != next_tag)
-            bad_chunk = true;
+    if (!ctl_char)
+        return;
+    if (ctl_busy) {
+        ctl_next = value;
+        return;
     }
-    last_tag = tag;
+    ctl_busy = true;
+    const data = new Uint8Array(value);
+    const op = ctl_char.writeValueWithoutResponse ? ctl_char.writeValueWithoutResponse(data) : ctl_char.writeValue(data);
+    op.catch((err) => {
+        console.log('Control write failed:', err.message);
+    }).
+    then(() => {
+        ctl_busy = false;
+        if (ctl_next) {
+            const next = ctl_next;
+            ctl_next = null;
+            writeControl(next);
+        }
+    });
+}
 
-    if (bad_chunk) {
-        bad_chunks += 1;
-        bad_msgs += 1;
-        msg_buff = null;
+function onWorkerResult(event)
+{
+    const res = event.data;
+    if (res.ctl) {
+        writeControl(res.ctl);
+        return;
     }
-
-    let start = 1, off = 1;
-    for (;;) {
-        const i = msg.indexOf(msg_start, off);
-        if (i >= 0) {
-            if (msg_buff !== null)
-                on_new_msg(msg_buff + msg.slice(start, i));
-            msg_buff = '';
-            start = i;
-            off = i + 1;
-        } else {
-            msg_buff += msg.slice(start);
-            break;
-        }
+    for (const line of res.lines)
+        pending_lines.push(line);
+    if (pending_lines.length > rx_msg_max)
+        pending_lines.splice(0, pending_lines.length - rx_msg_max);
+    pending_stats = res.stats;
+    if (!frame_req) {
+        frame_req = true;
+        requestAnimationFrame(onAnimationFrame);
     }
+}
 
-    showMessage(msg);
-    total_chunks += 1;
-
-    chunks.innerHTML = total_chunks + ' / ' + bad_chunks;
-    msgs.innerHTML   = total_msgs   + ' / ' + bad_msgs;
+function onDisconnection(event)
+{
+    const device = event.target;
+    console.log(device.name + ' bluetooth device disconnected');
+    rx_msg.classList.add('disabled');
+    bt_char  = null;
+    ctl_char = null;
+    ctl_next = null;
+    rx_worker.postMessage({reset: true});
+    connectTo(device);
 }
 
 function onValueChanged(event)
 {
     const value = event.target.value;
-    let msg = '';
-    for (let i = 0; i < value.byteLength; i++) {
-        const c = value.getUint8(i);
-        msg += String.fromCharCode(c);
-    }
-    on_new_chunk(msg);
+    // Copy the data since the DataView may be reused by the browser, then hand it over to the worker
+    const buf = value.buffer.slice(value.byteOffset, value.byteOffset + value.byteLength);
+    rx_worker.postMessage({buf: buf, t: now()}, [buf]);
 }
 
 function onBTConnected(device, characteristic)
 {
-    console.log(device.name, 'connected');
-    characteristic.addEventListener('characteristicvaluechanged', onValueChanged);
+    console.log(device.name, 'connected', ctl_char ? 'with retransmission' : '');
     device.addEventListener('gattserverdisconnected', onDisconnection);
-    rx_msg.disabled = false;
+    rx_msg.classList.remove('disabled');
     bt_char = characteristic;
 }
 
+// Enable selective retransmission if supported. It must be done before enabling notifications.
+function getControl(service)
+{
+    return service.getCharacteristic(bt_ctl_id).
+    then((characteristic) => {
+        return characteristic.writeValue(new Uint8Array([bt_no_ack])).then(() => characteristic);
+    },
+    (err) => {
+        console.log('No retransmission control:', err.message);
+        return null;
+    });
+}
+
 function connectTo(device)
 {
     device.gatt.connect().
@@ -140,10 +177,15 @@ function connectTo(device)
     }).
     then((service) => {
         console.log(device.name, 'service found, getting characteristic...');
-        return service.getCharacteristic(bt_char_id);
+        return getControl(service).then((ctl) => {
+            ctl_char = ctl;
+            return service.getCharacteristic(bt_char_id);
+        });
     }).
     then((characteristic) => {
         console.log(device.name, 'characteristic found');
+        rx_worker.postMessage({reset: true, reliable: ctl_char !== null});
+        characteristic.addEventListener('characteristicvaluechanged', onValueChanged);
         return characteristic.startNotifications().then(
             () => {
                 onBTConnected(device, characteristic);
@@ -156,6 +198,7 @@ function connectTo(device)
     })
     .catch((err) => {
         console.log('Failed to connect to ' + device.name + ':', err.message);
+        ctl_char = null;
         setTimeout(() => { connectTo(device); }, 500);
     });
 }